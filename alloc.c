@@ -0,0 +1,65 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "alloc.h"
+#include "utils.h"
+
+#ifdef ALLOC_GUARD
+
+/* The linker sends our own calls to __wrap_*, see ALLOC_GUARD in the Makefile */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+
+static bool g_armed;
+
+static void
+guard(const char *fn)
+{
+	if (!g_armed)
+		return;
+
+	g_armed = false;  /* warn() must not come back here */
+	warn("[ALLOC] %s() after warm-up", fn);
+	abort();
+}
+
+void *
+__wrap_malloc(size_t size)
+{
+	guard("malloc");
+	return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t size)
+{
+	guard("calloc");
+	return __real_calloc(nmemb, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+	guard("realloc");
+	return __real_realloc(ptr, size);
+}
+
+char *
+__wrap_strdup(const char *s)
+{
+	guard("strdup");
+	return __real_strdup(s);
+}
+
+#endif /* ALLOC_GUARD */
+
+void
+alloc_guard_arm(void)
+{
+#ifdef ALLOC_GUARD
+	g_armed = true;
+#endif
+}
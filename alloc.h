@@ -0,0 +1,18 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef XCOFFEEBREAK_ALLOC_H
+#define XCOFFEEBREAK_ALLOC_H
+
+/*
+ * Allocation guard of debug builds (make ALLOC_GUARD=1). Long-lived
+ * state is allocated by the *_init() functions, with tables sized by
+ * the *_MAX_* bounds of each header, so the main loop needs no heap.
+ * Once armed, a malloc(), calloc(), realloc() or strdup() made by
+ * xcoffeebreak's own code aborts; libraries (libdbus, Xlib, and libc
+ * internally, e.g. opendir() or stdio) are not checked. A no-op in
+ * normal builds; make check runs the loop with it, see
+ * tests/check_guard.c.
+ */
+void alloc_guard_arm(void);
+
+#endif /* XCOFFEEBREAK_ALLOC_H */
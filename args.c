@@ -21,7 +21,15 @@ enum {
 	OPT_SUSPEND_S,
 	OPT_SUSPEND_CMD,
 	OPT_POLL_MS,
+	OPT_PLAYER_ALLOW,
+	OPT_PLAYER_DENY,
+	OPT_STALE_S,
+	OPT_AUDIO_INHIBIT,
+	OPT_CAPTURE_INHIBIT,
+	OPT_CAMERA_INHIBIT,
+	OPT_CTL,
 	OPT_VERBOSE,
+	OPT_JOURNAL,
 	OPT_DRY_RUN,
 	OPT_HELP,
 	OPT_VERSION,
@@ -37,8 +45,16 @@ args_defaults(Options *o)
 	o->suspend_s = 45 * 60;
 	o->suspend_cmd = estrdup("systemctl suspend");
 	o->poll_ms = 1000;
+	o->stale_s = 0;
 	o->verbose = false;
+	o->journal = false;
 	o->dry_run = false;
+	o->audio_inhibit = false;
+	o->capture_inhibit = false;
+	o->camera_inhibit = false;
+	o->ctl = NULL;
+	o->player_allow.head = NULL;
+	o->player_deny.head = NULL;
 }
 
 static int
@@ -63,15 +79,21 @@ parseul(unsigned long *n, const char *s)
 static void
 usage(void)
 {
-	fputs("usage: xcoffeebreak [--help][--verbose][--dry_run]\n"
+	fputs("usage: xcoffeebreak [--help][--verbose][--journal][--dry_run]\n"
 	      "                    [--lock_s seconds][--lock_cmd cmd]\n"
 	      "                    [--off_s seconds][--off_cmd cmd]\n"
 	      "                    [--suspend_s seconds][--suspend_cmd cmd]\n"
 	      "                    [--poll_ms milliseconds]\n"
+	      "                    [--player_allow globs][--player_deny globs]\n"
+	      "                    [--stale_s seconds]\n"
+	      "                    [--audio_inhibit][--capture_inhibit]\n"
+	      "                    [--camera_inhibit]\n"
+	      "       xcoffeebreak --ctl status|lock|pause seconds|resume|subscribe\n"
 	      "\n"
 	      "--help              Print this message and exit\n"
 	      "--version           Print version and exit\n"
 	      "--verbose           Print state transitions\n"
+	      "--journal           Log to the systemd journal with structured fields\n"
 	      "--dry_run           Do not run commands (log only)\n"
 	      "--poll_ms           Set polling rate in milliseconds\n"
 	      "--lock_s            Set locker time in seconds\n"
@@ -80,6 +102,13 @@ usage(void)
 	      "--off_cmd           Set screen off command\n"
 	      "--suspend_s         Set suspend time in seconds\n"
 	      "--suspend_cmd       Set suspend command\n"
+	      "--player_allow      Only these MPRIS players inhibit (comma separated globs)\n"
+	      "--player_deny       These MPRIS players never inhibit (comma separated globs)\n"
+	      "--stale_s           Ignore a playing player whose position is frozen this long\n"
+	      "--audio_inhibit     Running ALSA playback keeps the screen on\n"
+	      "--capture_inhibit   Running ALSA capture (calls) blocks every stage\n"
+	      "--camera_inhibit    An open /dev/video* device blocks every stage\n"
+	      "--ctl               Send a request to the running daemon and exit\n"
 	      "\n"
 	      "Defaults:\n"
 	      "  lock_s      900  (15 min)\n"
@@ -88,7 +117,8 @@ usage(void)
 	      "  lock_cmd    slock\n"
 	      "  off_cmd     xset dpms force off\n"
 	      "  suspend_cmd systemctl suspend\n"
-	      "  poll_ms     1000\n",
+	      "  poll_ms     1000\n"
+	      "  stale_s     0    (disabled)\n",
 	      stderr);
 
 }
@@ -97,18 +127,26 @@ static int
 args_argv(Options *o, const int argc, char *argv[])
 {
 	struct option longopts[] = {
-		{ "lock_s",      required_argument, 0, OPT_LOCK_S      },
-		{ "lock_cmd",    required_argument, 0, OPT_LOCK_CMD    },
-		{ "off_s",       required_argument, 0, OPT_OFF_S       },
-		{ "off_cmd",     required_argument, 0, OPT_OFF_CMD     },
-		{ "suspend_s",   required_argument, 0, OPT_SUSPEND_S   },
-		{ "suspend_cmd", required_argument, 0, OPT_SUSPEND_CMD },
-		{ "poll_ms",     required_argument, 0, OPT_POLL_MS     },
-		{ "verbose",     no_argument,       0, OPT_VERBOSE     },
-		{ "dry_run",     no_argument,       0, OPT_DRY_RUN     },
-		{ "help",        no_argument,       0, OPT_HELP        },
-		{ "version",     no_argument,       0, OPT_VERSION     },
-		{ 0,             0,                 0, 0               },
+		{ "lock_s",          required_argument, 0, OPT_LOCK_S          },
+		{ "lock_cmd",        required_argument, 0, OPT_LOCK_CMD        },
+		{ "off_s",           required_argument, 0, OPT_OFF_S           },
+		{ "off_cmd",         required_argument, 0, OPT_OFF_CMD         },
+		{ "suspend_s",       required_argument, 0, OPT_SUSPEND_S       },
+		{ "suspend_cmd",     required_argument, 0, OPT_SUSPEND_CMD     },
+		{ "poll_ms",         required_argument, 0, OPT_POLL_MS         },
+		{ "player_allow",    required_argument, 0, OPT_PLAYER_ALLOW    },
+		{ "player_deny",     required_argument, 0, OPT_PLAYER_DENY     },
+		{ "stale_s",         required_argument, 0, OPT_STALE_S         },
+		{ "audio_inhibit",   no_argument,       0, OPT_AUDIO_INHIBIT   },
+		{ "capture_inhibit", no_argument,       0, OPT_CAPTURE_INHIBIT },
+		{ "camera_inhibit",  no_argument,       0, OPT_CAMERA_INHIBIT  },
+		{ "ctl",             required_argument, 0, OPT_CTL             },
+		{ "verbose",         no_argument,       0, OPT_VERBOSE         },
+		{ "journal",         no_argument,       0, OPT_JOURNAL         },
+		{ "dry_run",         no_argument,       0, OPT_DRY_RUN         },
+		{ "help",            no_argument,       0, OPT_HELP            },
+		{ "version",         no_argument,       0, OPT_VERSION         },
+		{ 0,                 0,                 0, 0                   },
 	};
 
 	int opt;
@@ -157,10 +195,52 @@ args_argv(Options *o, const int argc, char *argv[])
 			}
 			break;
 
+		case OPT_PLAYER_ALLOW:
+			if (patterns_add(&o->player_allow, optarg)) {
+				warn("invalid argument for --player_allow");
+				return -1;
+			}
+			break;
+
+		case OPT_PLAYER_DENY:
+			if (patterns_add(&o->player_deny, optarg)) {
+				warn("invalid argument for --player_deny");
+				return -1;
+			}
+			break;
+
+		case OPT_STALE_S:
+			if (parseul(&o->stale_s, optarg)) {
+				warn("invalid argument for --stale_s");
+				return -1;
+			}
+			break;
+
+		case OPT_AUDIO_INHIBIT:
+			o->audio_inhibit = true;
+			break;
+
+		case OPT_CAPTURE_INHIBIT:
+			o->capture_inhibit = true;
+			break;
+
+		case OPT_CAMERA_INHIBIT:
+			o->camera_inhibit = true;
+			break;
+
+		case OPT_CTL:
+			free(o->ctl);
+			o->ctl = estrdup(optarg);
+			break;
+
 		case OPT_VERBOSE:
 			o->verbose = true;
 			break;
 
+		case OPT_JOURNAL:
+			o->journal = true;
+			break;
+
 		case OPT_DRY_RUN:
 			o->dry_run = true;
 			break;
@@ -180,6 +260,23 @@ args_argv(Options *o, const int argc, char *argv[])
 		}
 	}
 
+	/* "--ctl pause 1800": the rest of the line belongs to the request */
+	for (; optind < argc; optind++) {
+		char *req;
+		size_t n;
+
+		if (!o->ctl) {
+			warn("unexpected argument: %s", argv[optind]);
+			return -1;
+		}
+
+		n = strlen(o->ctl) + 1 + strlen(argv[optind]) + 1;
+		req = ecalloc(n, 1);
+		snprintf(req, n, "%s %s", o->ctl, argv[optind]);
+		free(o->ctl);
+		o->ctl = req;
+	}
+
 	return 0;
 }
 
@@ -231,5 +328,8 @@ args_free(Options *o)
 	free(o->lock_cmd);
 	free(o->off_cmd);
 	free(o->suspend_cmd);
+	free(o->ctl);
+	patterns_free(&o->player_allow);
+	patterns_free(&o->player_deny);
 	memset(o, 0, sizeof(*o));
 }
@@ -4,17 +4,26 @@
 #define XCOFFEBREAK_ARGS_H
 
 #include <stdbool.h>
+#include "pattern.h"
 
 typedef struct {
 	unsigned long  lock_s;
 	unsigned long  off_s;
 	unsigned long  suspend_s;
 	unsigned long  poll_ms;
+	unsigned long  stale_s;       /* 0 = never judge players stale */
 	bool           verbose;
+	bool           journal;       /* log to the journal, not stderr */
 	bool           dry_run;
+	bool           audio_inhibit;   /* RUNNING ALSA playback inhibits */
+	bool           capture_inhibit; /* RUNNING ALSA capture inhibits */
+	bool           camera_inhibit;  /* open /dev/video* inhibits */
 	char          *lock_cmd;
 	char          *off_cmd;
 	char          *suspend_cmd;
+	char          *ctl;           /* --ctl: client request, NULL = daemon */
+	PatternList    player_allow;  /* empty = every player counts */
+	PatternList    player_deny;
 } Options;
 
 /*
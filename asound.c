@@ -0,0 +1,327 @@
+/* See LICENSE file for copyright and license details. */
+
+#define _DEFAULT_SOURCE  /* syscall */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "asound.h"
+#include "state.h"
+#include "utils.h"
+
+#define ASOUND_MAX_SUBSTREAMS 64     /* status fds kept open */
+#define ASOUND_RETRY_MS       10000  /* re-open root/pcm while missing, re-walk on bad fds */
+#define ASOUND_RUNNING        "state: RUNNING"
+
+typedef struct {
+	int  fd;                 /* .../subN/status */
+	bool capture;
+} Substream;
+
+struct Asound {
+	char *root;
+	bool capture;            /* watch capture substreams too */
+	bool verbose;
+
+	int pcm_fd;              /* root/pcm, lists devices; -1 if missing */
+	unsigned long pcm_hash;  /* of its last content, change detector */
+	unsigned long long pcm_retry_ms;
+	bool rescan;             /* a status fd went bad */
+	unsigned long long scan_ms; /* last walk, rescans wait ASOUND_RETRY_MS after it */
+
+	Substream subs[ASOUND_MAX_SUBSTREAMS];
+	size_t nsubs;
+};
+
+/*
+ * Directory reader on a caller-provided buffer. Rescans run from the
+ * main loop, where opendir() would allocate its DIR on every walk.
+ */
+typedef struct {
+	int fd;
+	size_t pos, len;
+	char buf[2048] __attribute__((aligned(8)));
+} Dir;
+
+/* The kernel's record, as returned by getdents64(2) */
+struct dirent64_rec {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/* --------------------------------- dir reader ---------------------------- */
+
+static bool
+dir_open(Dir *d, const char *path)
+{
+	d->pos = d->len = 0;
+	d->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	return d->fd >= 0;
+}
+
+/* Next entry name, NULL at the end or on error */
+static const char *
+dir_next(Dir *d)
+{
+	const struct dirent64_rec *de;
+	long n;
+
+	if (d->pos >= d->len) {
+		if ((n = syscall(SYS_getdents64, d->fd, d->buf, sizeof(d->buf))) <= 0)
+			return NULL;
+		d->pos = 0;
+		d->len = (size_t)n;
+	}
+
+	de = (const struct dirent64_rec *)(d->buf + d->pos);
+	d->pos += de->d_reclen;
+	return de->d_name;
+}
+
+static void
+dir_close(Dir *d)
+{
+	close(d->fd);
+}
+
+/* --------------------------------- scanning ------------------------------ */
+
+/* "prefix<digits><suffix>" with an optional single suffix char. */
+static bool
+name_is(const char *name, const char *prefix, char suffix)
+{
+	size_t n = strlen(prefix);
+	const char *s;
+
+	if (strncmp(name, prefix, n) != 0)
+		return false;
+
+	s = name + n;
+	if (*s < '0' || *s > '9')
+		return false;
+	while (*s >= '0' && *s <= '9')
+		s++;
+
+	return suffix ? (s[0] == suffix && s[1] == '\0') : *s == '\0';
+}
+
+static void
+subs_close(Asound *a)
+{
+	for (size_t i = 0; i < a->nsubs; i++)
+		close(a->subs[i].fd);
+	a->nsubs = 0;
+}
+
+static void
+scan_pcm(Asound *a, const char *path, bool capture)
+{
+	char status[PATH_MAX];
+	const char *name;
+	Dir d;
+
+	if (!dir_open(&d, path))
+		return;
+
+	while ((name = dir_next(&d))) {
+		int fd;
+
+		if (!name_is(name, "sub", 0))
+			continue;
+
+		if (a->nsubs == ASOUND_MAX_SUBSTREAMS) {
+			warn("[ASOUND] more than %d substreams, ignoring the rest", ASOUND_MAX_SUBSTREAMS);
+			break;
+		}
+
+		if (snprintf(status, sizeof(status), "%s/%s/status", path, name) >= (int)sizeof(status))
+			continue;
+
+		if ((fd = open(status, O_RDONLY | O_CLOEXEC)) < 0)
+			continue;
+
+		a->subs[a->nsubs].fd = fd;
+		a->subs[a->nsubs].capture = capture;
+		a->nsubs++;
+	}
+
+	dir_close(&d);
+}
+
+static void
+scan_card(Asound *a, const char *path)
+{
+	char pcm[PATH_MAX];
+	const char *name;
+	Dir d;
+
+	if (!dir_open(&d, path))
+		return;
+
+	while ((name = dir_next(&d))) {
+		bool capture;
+
+		if (name_is(name, "pcm", 'p'))
+			capture = false;
+		else if (a->capture && name_is(name, "pcm", 'c'))
+			capture = true;
+		else
+			continue;
+
+		if (snprintf(pcm, sizeof(pcm), "%s/%s", path, name) < (int)sizeof(pcm))
+			scan_pcm(a, pcm, capture);
+	}
+
+	dir_close(&d);
+}
+
+/* Walk root once and cache an fd per substream status file. */
+static void
+scan(Asound *a)
+{
+	char card[PATH_MAX];
+	const char *name;
+	Dir d;
+
+	subs_close(a);
+	a->rescan = false;
+	a->scan_ms = monotonic_ms();
+
+	if (!dir_open(&d, a->root))
+		return;
+
+	while ((name = dir_next(&d)))
+		if (name_is(name, "card", 0) &&
+		    snprintf(card, sizeof(card), "%s/%s", a->root, name) < (int)sizeof(card))
+			scan_card(a, card);
+
+	dir_close(&d);
+
+	verbose(a->verbose, "[ASOUND] watching %zu substreams", a->nsubs);
+}
+
+/*
+ * root/pcm lists every PCM device; it changes when cards or devices come
+ * and go, which is the only time the tree needs a walk.
+ */
+static bool
+pcm_changed(Asound *a)
+{
+	char buf[4096];
+	unsigned long h = 5381;
+	ssize_t n;
+
+	if (a->pcm_fd < 0) {
+		unsigned long long now_ms = monotonic_ms();
+		char path[PATH_MAX];
+
+		if (now_ms < a->pcm_retry_ms)
+			return false;
+		a->pcm_retry_ms = now_ms + ASOUND_RETRY_MS;
+
+		if (snprintf(path, sizeof(path), "%s/pcm", a->root) >= (int)sizeof(path) ||
+		    (a->pcm_fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+			return false;
+	}
+
+	if ((n = pread(a->pcm_fd, buf, sizeof(buf), 0)) < 0) {
+		close(a->pcm_fd);
+		a->pcm_fd = -1;
+		a->pcm_hash = 0;
+		return true;
+	}
+
+	for (ssize_t i = 0; i < n; i++)
+		h = h * 33 + (unsigned char)buf[i];
+
+	if (h == a->pcm_hash)
+		return false;
+
+	a->pcm_hash = h;
+	return true;
+}
+
+/* ------------------------------ asound public ---------------------------- */
+
+Asound *
+asound_init(const char *root, bool capture, bool v)
+{
+	Asound *a;
+
+	a = calloc(1, sizeof(*a));
+	if (!a) {
+		warn("[ASOUND] calloc failed, running without audio inhibit");
+		return NULL;
+	}
+
+	if (!(a->root = strdup(root))) {
+		free(a);
+		warn("[ASOUND] strdup failed, running without audio inhibit");
+		return NULL;
+	}
+
+	a->capture = capture;
+	a->verbose = v;
+	a->pcm_fd = -1;
+
+	if (pcm_changed(a))
+		scan(a);
+	else
+		verbose(v, "[ASOUND] %s/pcm not available yet", root);
+
+	return a;
+}
+
+void
+asound_cleanup(Asound *a)
+{
+	if (!a)
+		return;
+
+	subs_close(a);
+	if (a->pcm_fd >= 0)
+		close(a->pcm_fd);
+	free(a->root);
+	free(a);
+}
+
+unsigned int
+asound_inhibit_mask(Asound *a)
+{
+	char buf[sizeof(ASOUND_RUNNING) - 1];
+	unsigned int mask = 0;
+
+	if (!a)
+		return 0;
+
+	/* A status file that keeps failing must not cost a walk every poll */
+	if (pcm_changed(a) || (a->rescan && monotonic_ms() - a->scan_ms >= ASOUND_RETRY_MS))
+		scan(a);
+
+	for (size_t i = 0; i < a->nsubs; i++) {
+		const Substream *s = &a->subs[i];
+		ssize_t n = pread(s->fd, buf, sizeof(buf), 0);
+
+		if (n < 0) {
+			a->rescan = true;
+			continue;
+		}
+
+		if ((size_t)n == sizeof(buf) && memcmp(buf, ASOUND_RUNNING, sizeof(buf)) == 0) {
+			mask |= s->capture ? INHIBIT_ALL : INHIBIT_AUDIO;
+			if (mask == INHIBIT_ALL)
+				break;
+		}
+	}
+
+	return mask;
+}
@@ -0,0 +1,34 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef XCOFFEEBREAK_ASOUND_H
+#define XCOFFEEBREAK_ASOUND_H
+
+#include <stdbool.h>
+
+#define ASOUND_ROOT "/proc/asound"
+
+typedef struct Asound Asound;
+
+/*
+ * Watch ALSA substream status files under root (normally ASOUND_ROOT):
+ * root/cardN/pcmNp/subN/status, and the pcmNc ones if capture is set.
+ *
+ * Returns an initialized structure on success,
+ * NULL on failiure.
+ */
+Asound *asound_init(const char *root, bool capture, bool verbose);
+
+/* Close all cached fds and free (safe to call with NULL). */
+void asound_cleanup(Asound *a);
+
+/*
+ * Read the cached status fds (a pread each; the card tree is re-scanned
+ * only when root/pcm changes, or at most every 10 s while a status read
+ * fails).
+ *
+ * Returns INHIBIT_* bits: INHIBIT_AUDIO while a playback substream is
+ * RUNNING, INHIBIT_ALL while a capture one is, 0 otherwise.
+ */
+unsigned int asound_inhibit_mask(Asound *a);
+
+#endif /* XCOFFEEBREAK_ASOUND_H */
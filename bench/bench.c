@@ -0,0 +1,184 @@
+/* See LICENSE file for copyright and license details. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../utils.h"
+#include "bench.h"
+
+volatile unsigned long bench_sink;
+
+unsigned long long
+bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+void
+bench_run(const char *name, const char *param, BenchFn fn, void *ctx)
+{
+	unsigned long long t0, dt, best = 0;
+	unsigned long iters = 1;
+
+	/* Grow the count until one round takes BENCH_MIN_NS */
+	for (;;) {
+		t0 = bench_now_ns();
+		fn(ctx, iters);
+		dt = bench_now_ns() - t0;
+		if (dt >= BENCH_MIN_NS)
+			break;
+		iters *= dt < BENCH_MIN_NS / 16 ? 16 : 2;
+	}
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		t0 = bench_now_ns();
+		fn(ctx, iters);
+		dt = bench_now_ns() - t0;
+		if (!best || dt < best)
+			best = dt;
+	}
+
+	printf("{\"version\":\"%s\",\"bench\":\"%s\",\"case\":\"%s\",\"iters\":%lu,\"ns_per_op\":%.2f}\n",
+	       VERSION, name, param, iters, (double)best / (double)iters);
+	fflush(stdout);
+}
+
+/* ------------------------------ private server ----------------------------- */
+
+static dbus_bool_t
+server_watch_add(DBusWatch *w, void *data)
+{
+	BenchServer *s = data;
+
+	if (s->nwatches == BENCH_SERVER_WATCHES)
+		return FALSE;
+	s->watches[s->nwatches++] = w;
+	return TRUE;
+}
+
+static void
+server_watch_remove(DBusWatch *w, void *data)
+{
+	BenchServer *s = data;
+
+	for (size_t i = 0; i < s->nwatches; i++) {
+		if (s->watches[i] == w) {
+			s->watches[i] = s->watches[--s->nwatches];
+			return;
+		}
+	}
+}
+
+static void
+server_watch_toggle(DBusWatch *w, void *data)
+{
+	(void)w;
+	(void)data;
+}
+
+static void
+server_new_connection(DBusServer *server, DBusConnection *c, void *data)
+{
+	BenchServer *s = data;
+
+	(void)server;
+	if (!s->peer)
+		s->peer = dbus_connection_ref(c);
+}
+
+void
+bench_server_open(BenchServer *s)
+{
+	DBusError err;
+
+	memset(s, 0, sizeof(*s));
+	dbus_error_init(&err);
+
+	if (!(s->server = dbus_server_listen("unix:tmpdir=/tmp", &err)))
+		die("dbus_server_listen: %s", err.message);
+
+	if (!dbus_server_set_watch_functions(s->server, server_watch_add, server_watch_remove,
+	                                     server_watch_toggle, s, NULL))
+		die("dbus_server_set_watch_functions failed");
+	dbus_server_set_new_connection_function(s->server, server_new_connection, s, NULL);
+
+	s->addr = dbus_server_get_address(s->server);
+}
+
+DBusConnection *
+bench_server_connect(BenchServer *s, bool link)
+{
+	struct timespec ts = { 0, 1000000L };
+	DBusConnection *conn;
+	DBusError err;
+
+	dbus_error_init(&err);
+	if (!(conn = dbus_connection_open_private(s->addr, &err)))
+		die("dbus_connection_open_private: %s", err.message);
+
+	if (!link)
+		return conn;
+
+	for (int i = 0; i < 5000; i++) {
+		bench_server_pump(s, conn);
+		if (s->peer && dbus_connection_get_is_authenticated(s->peer) &&
+		    dbus_connection_get_is_authenticated(conn))
+			return conn;
+		nanosleep(&ts, NULL);
+	}
+
+	die("peer connection did not authenticate");
+	return NULL;
+}
+
+void
+bench_server_pump(BenchServer *s, DBusConnection *conn)
+{
+	struct pollfd pfds[BENCH_SERVER_WATCHES];
+	DBusMessage *msg;
+	size_t n = 0;
+
+	for (size_t i = 0; i < s->nwatches; i++) {
+		pfds[n].fd = dbus_watch_get_unix_fd(s->watches[i]);
+		pfds[n].events = dbus_watch_get_enabled(s->watches[i]) ? POLLIN : 0;
+		pfds[n].revents = 0;
+		n++;
+	}
+
+	if (n && poll(pfds, (nfds_t)n, 0) > 0)
+		for (size_t i = 0; i < n && i < s->nwatches; i++)
+			if (pfds[i].revents & POLLIN)
+				dbus_watch_handle(s->watches[i], DBUS_WATCH_READABLE);
+
+	if (s->peer) {
+		dbus_connection_read_write(s->peer, 0);
+		while ((msg = dbus_connection_pop_message(s->peer)))
+			dbus_message_unref(msg);
+	}
+
+	dbus_connection_read_write(conn, 0);
+}
+
+void
+bench_conn_close(DBusConnection *conn)
+{
+	dbus_connection_close(conn);
+	dbus_connection_unref(conn);
+}
+
+void
+bench_server_close(BenchServer *s)
+{
+	if (s->peer)
+		bench_conn_close(s->peer);
+	dbus_free(s->addr);
+	dbus_server_disconnect(s->server);
+	dbus_server_unref(s->server);
+}
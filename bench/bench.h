@@ -0,0 +1,66 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef XCOFFEEBREAK_BENCH_H
+#define XCOFFEEBREAK_BENCH_H
+
+#include <dbus/dbus.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BENCH_MIN_NS 100000000ULL  /* calibrate to at least 100 ms per round */
+#define BENCH_ROUNDS 5             /* report the fastest round */
+#define BENCH_SERVER_WATCHES 4     /* listening socket plus one accepted peer */
+
+/* Run the operation under test iters times. */
+typedef void (*BenchFn)(void *ctx, unsigned long iters);
+
+/* Keeps results alive so the compiler cannot drop the work. */
+extern volatile unsigned long bench_sink;
+
+/*
+ * Calibrate an iteration count, time BENCH_ROUNDS rounds and print one
+ * JSON line: {"bench":name,"case":param,"iters":..,"ns_per_op":..}.
+ */
+void bench_run(const char *name, const char *param, BenchFn fn, void *ctx);
+
+/* CLOCK_MONOTONIC in ns. */
+unsigned long long bench_now_ns(void);
+
+/*
+ * A private DBusServer to open connections against, no bus daemon
+ * involved. Shared by the bus and MPRIS fixtures and by replay.
+ */
+typedef struct {
+	DBusServer *server;
+	char *addr;
+	DBusWatch *watches[BENCH_SERVER_WATCHES];
+	size_t nwatches;
+	DBusConnection *peer;  /* server side of the first accepted connection */
+} BenchServer;
+
+/* Listen on a fresh socket under /tmp, dies on failure. */
+void bench_server_open(BenchServer *s);
+
+/*
+ * Open a private client connection to the server, dies on failure.
+ * With link, pump both ends until they are authenticated so messages
+ * sent on s->peer reach the returned connection.
+ */
+DBusConnection *bench_server_connect(BenchServer *s, bool link);
+
+/* One non-blocking round of I/O on the server, its peer and conn. */
+void bench_server_pump(BenchServer *s, DBusConnection *conn);
+
+/* Close and unref a connection from bench_server_connect(). */
+void bench_conn_close(DBusConnection *conn);
+
+/* Drop the peer and stop listening. */
+void bench_server_close(BenchServer *s);
+
+/* Suites, one per translation unit under test */
+void bench_state(void);
+void bench_mpris(void);
+void bench_bus(void);
+void bench_log(void);
+
+#endif /* XCOFFEEBREAK_BENCH_H */
@@ -0,0 +1,108 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Watch bookkeeping is static: build bus.c into this translation unit
+ * and register the watches of many private connections on one Bus.
+ */
+#define BENCH_MAX_CONNS 128
+#define BUS_MAX_WATCHES (2 * BENCH_MAX_CONNS)  /* a read and a write watch each */
+
+#include "../bus.c"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+
+typedef struct {
+	Bus b;
+	BenchServer srv;
+	DBusConnection *conns[BENCH_MAX_CONNS];
+	size_t nconns;
+} Fixture;
+
+static void
+fixture_init(Fixture *f, size_t nconns)
+{
+	memset(f, 0, sizeof(*f));
+	bench_server_open(&f->srv);
+
+	/* Connections only need to exist; nobody ever authenticates */
+	for (; f->nconns < nconns; f->nconns++) {
+		DBusConnection *c = bench_server_connect(&f->srv, false);
+
+		if (!dbus_connection_set_watch_functions(c, watch_add, watch_remove, watch_toggle, &f->b, NULL))
+			die("set_watch_functions failed");
+		f->conns[f->nconns] = c;
+	}
+
+	/* bus_pollfds() reports nothing while the Bus has no connection */
+	f->b.conn = f->conns[0];
+}
+
+static void
+fixture_free(Fixture *f)
+{
+	for (size_t i = 0; i < f->nconns; i++) {
+		dbus_connection_set_watch_functions(f->conns[i], NULL, NULL, NULL, NULL, NULL);
+		bench_conn_close(f->conns[i]);
+	}
+
+	bench_server_close(&f->srv);
+}
+
+/*
+ * What the main loop does every wakeup: snapshot the set into its array
+ * (see pollfds_add()), then poll() fills in revents. The barrier stands
+ * in for poll(): without it the copy is loop-invariant and gets hoisted,
+ * and every n measures the same.
+ */
+static void
+run_pollfds(void *ctx, unsigned long iters)
+{
+	static struct pollfd copy[2 * BENCH_MAX_CONNS];
+	Fixture *f = ctx;
+
+	for (unsigned long i = 0; i < iters; i++) {
+		const struct pollfd *src;
+		size_t n = bus_pollfds(&f->b, &src);
+
+		for (size_t j = 0; j < n; j++) {
+			copy[j] = src[j];
+			copy[j].revents = 0;
+		}
+		__asm__ __volatile__("" : : "r"(copy) : "memory");
+
+		if (n)
+			bench_sink += (unsigned long)copy[i % n].fd;
+	}
+}
+
+/* libdbus toggling a write watch: one pfd_sync() over all watches */
+static void
+run_toggle(void *ctx, unsigned long iters)
+{
+	Fixture *f = ctx;
+
+	for (unsigned long i = 0; i < iters; i++)
+		watch_toggle(f->b.watches[i % f->b.nwatches].watch, &f->b);
+	bench_sink += f->b.npfds;
+}
+
+void
+bench_bus(void)
+{
+	static const size_t counts[] = { 1, 8, 32, 128 };
+	static Fixture f;
+	char param[64];
+
+	for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		fixture_init(&f, counts[i]);
+
+		snprintf(param, sizeof(param), "watches=%zu,fds=%zu", f.b.nwatches, f.b.npfds);
+		bench_run("bus_pollfds", param, run_pollfds, &f);
+		bench_run("watch_toggle", param, run_toggle, &f);
+
+		fixture_free(&f);
+	}
+}
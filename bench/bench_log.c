@@ -0,0 +1,65 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * The rate limiter is static: build log.c into this translation unit so
+ * the emit case can clear it between messages. Output goes to
+ * /dev/null, what is measured is formatting and the write() itself.
+ */
+#include "../log.c"
+
+#include <fcntl.h>
+
+#include "bench.h"
+
+static void
+run_emit(void *ctx, unsigned long iters)
+{
+	(void)ctx;
+	for (unsigned long i = 0; i < iters; i++) {
+		memset(g_rate, 0, sizeof(g_rate));
+		log_fields(true, NULL, "[MPRIS] %s %s -> %s", "org.mpris.MediaPlayer2.bench",
+		           (i & 1) ? "playing" : "stopped", (i & 1) ? "stopped" : "playing");
+	}
+}
+
+/* A PropertiesChanged storm: the same call site past LOG_BURST */
+static void
+run_suppressed(void *ctx, unsigned long iters)
+{
+	(void)ctx;
+	for (unsigned long i = 0; i < iters; i++)
+		log_fields(true, NULL, "[MPRIS] %s %s -> %s", "org.mpris.MediaPlayer2.bench",
+		           (i & 1) ? "playing" : "stopped", (i & 1) ? "stopped" : "playing");
+}
+
+static void
+run_disabled(void *ctx, unsigned long iters)
+{
+	(void)ctx;
+	for (unsigned long i = 0; i < iters; i++)
+		log_fields(false, NULL, "[MPRIS] %s %s -> %s", "org.mpris.MediaPlayer2.bench",
+		           "stopped", "playing");
+}
+
+void
+bench_log(void)
+{
+	int saved, null;
+
+	if ((null = open("/dev/null", O_WRONLY | O_CLOEXEC)) < 0)
+		return;
+
+	saved = dup(STDERR_FILENO);
+	dup2(null, STDERR_FILENO);
+	close(null);
+
+	bench_run("log", "emit", run_emit, NULL);
+	bench_run("log", "suppressed", run_suppressed, NULL);
+	bench_run("log", "disabled", run_disabled, NULL);
+
+	memset(g_rate, 0, sizeof(g_rate));
+	if (saved >= 0) {
+		dup2(saved, STDERR_FILENO);
+		close(saved);
+	}
+}
@@ -0,0 +1,162 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * The hot paths are static: build them into this translation unit and
+ * drive them on a bare Mpris with no bus attached.
+ */
+#include "../mpris.c"
+
+#include "bench.h"
+
+#define NAME_FMT  "org.mpris.MediaPlayer2.bench%u"
+#define OWNER_FMT ":1.%u"
+
+typedef struct {
+	Mpris m;
+	unsigned int nplayers;
+	DBusMessage *msgs[2];  /* alternated, e.g. Playing / Paused */
+} Fixture;
+
+static void
+fixture_init(Fixture *f, unsigned int nplayers)
+{
+	char buf[64];
+
+	memset(f, 0, sizeof(*f));
+	f->nplayers = nplayers;
+
+	for (unsigned int i = 0; i < nplayers; i++) {
+		Player *p;
+
+		snprintf(buf, sizeof(buf), NAME_FMT, i);
+		if (!(p = player_add(&f->m, buf)))
+			die("player_add failed");
+		snprintf(buf, sizeof(buf), OWNER_FMT, i);
+		player_set_owner(&f->m, p, buf);
+	}
+}
+
+static void
+fixture_free(Fixture *f)
+{
+	players_clear(&f->m);
+	for (size_t i = 0; i < 2; i++)
+		if (f->msgs[i])
+			dbus_message_unref(f->msgs[i]);
+}
+
+/* PropertiesChanged(iface, {key: <value>}, []) from sender */
+static DBusMessage *
+new_properties_changed(const char *sender, const char *iface, const char *key, const char *value,
+                       const char *url)
+{
+	DBusMessageIter it, dict, entry, var, meta, mentry, mvar, inv;
+	DBusMessage *msg;
+	const char *k = "xesam:url";
+
+	msg = dbus_message_new_signal("/org/mpris/MediaPlayer2", "org.freedesktop.DBus.Properties",
+	                              "PropertiesChanged");
+	if (!msg || !dbus_message_set_sender(msg, sender))
+		die("dbus_message_new_signal failed");
+
+	dbus_message_iter_init_append(msg, &it);
+	dbus_message_iter_append_basic(&it, DBUS_TYPE_STRING, &iface);
+	dbus_message_iter_open_container(&it, DBUS_TYPE_ARRAY, "{sv}", &dict);
+
+	dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+	if (url) {
+		/* Metadata: a{sv} with xesam:url */
+		dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "a{sv}", &var);
+		dbus_message_iter_open_container(&var, DBUS_TYPE_ARRAY, "{sv}", &meta);
+		dbus_message_iter_open_container(&meta, DBUS_TYPE_DICT_ENTRY, NULL, &mentry);
+		dbus_message_iter_append_basic(&mentry, DBUS_TYPE_STRING, &k);
+		dbus_message_iter_open_container(&mentry, DBUS_TYPE_VARIANT, "s", &mvar);
+		dbus_message_iter_append_basic(&mvar, DBUS_TYPE_STRING, &url);
+		dbus_message_iter_close_container(&mentry, &mvar);
+		dbus_message_iter_close_container(&meta, &mentry);
+		dbus_message_iter_close_container(&var, &meta);
+	} else {
+		dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "s", &var);
+		dbus_message_iter_append_basic(&var, DBUS_TYPE_STRING, &value);
+	}
+	dbus_message_iter_close_container(&entry, &var);
+	dbus_message_iter_close_container(&dict, &entry);
+
+	dbus_message_iter_close_container(&it, &dict);
+	dbus_message_iter_open_container(&it, DBUS_TYPE_ARRAY, "s", &inv);
+	dbus_message_iter_close_container(&it, &inv);
+
+	return msg;
+}
+
+static void
+run_find(void *ctx, unsigned long iters)
+{
+	Fixture *f = ctx;
+	char name[64];
+
+	for (unsigned long i = 0; i < iters; i++) {
+		snprintf(name, sizeof(name), NAME_FMT, (unsigned int)(i % f->nplayers));
+		bench_sink += player_find(&f->m, name) != NULL;
+	}
+}
+
+static void
+run_properties(void *ctx, unsigned long iters)
+{
+	Fixture *f = ctx;
+
+	for (unsigned long i = 0; i < iters; i++)
+		handle_properties_changed(&f->m, f->msgs[i & 1]);
+	bench_sink += f->m.playing_count;
+}
+
+void
+bench_mpris(void)
+{
+	static const unsigned int counts[] = { 1, 8, MPRIS_MAX_PLAYERS };
+	static Fixture f;
+	char param[64], sender[32];
+
+	for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		fixture_init(&f, counts[i]);
+		snprintf(param, sizeof(param), "players=%u", counts[i]);
+		bench_run("player_find", param, run_find, &f);
+		fixture_free(&f);
+	}
+
+	for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		unsigned int n = counts[i];
+
+		/* The oldest player sits at the tail of the list: worst case */
+		fixture_init(&f, n);
+		snprintf(sender, sizeof(sender), OWNER_FMT, 0u);
+
+		f.msgs[0] = new_properties_changed(sender, "org.mpris.MediaPlayer2.Player",
+		                                   "PlaybackStatus", "Playing", NULL);
+		f.msgs[1] = new_properties_changed(sender, "org.mpris.MediaPlayer2.Player",
+		                                   "PlaybackStatus", "Paused", NULL);
+		snprintf(param, sizeof(param), "status_flip,players=%u", n);
+		bench_run("handle_properties_changed", param, run_properties, &f);
+		fixture_free(&f);
+
+		fixture_init(&f, n);
+		f.msgs[0] = new_properties_changed(sender, "org.mpris.MediaPlayer2.Player",
+		                                   "Metadata", NULL, "https://www.youtube.com/watch?v=a");
+		f.msgs[1] = new_properties_changed(sender, "org.mpris.MediaPlayer2.Player",
+		                                   "Metadata", NULL, "file:///music/track.flac");
+		snprintf(param, sizeof(param), "metadata_flip,players=%u", n);
+		bench_run("handle_properties_changed", param, run_properties, &f);
+		fixture_free(&f);
+
+		/* Not ours: rejected on the sender lookup */
+		fixture_init(&f, n);
+		f.msgs[0] = new_properties_changed(":9.9", "org.mpris.MediaPlayer2.Player",
+		                                   "PlaybackStatus", "Playing", NULL);
+		f.msgs[1] = dbus_message_ref(f.msgs[0]);
+		snprintf(param, sizeof(param), "unknown_sender,players=%u", n);
+		bench_run("handle_properties_changed", param, run_properties, &f);
+		fixture_free(&f);
+	}
+}
@@ -0,0 +1,105 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <stdio.h>
+
+#include "bench.h"
+#include "../state.h"
+
+#define SEQ_LEN 4096
+
+typedef struct {
+	Options opt;
+	StateManager sm;
+	unsigned long raw[SEQ_LEN];     /* X idle samples, ms */
+	unsigned int inhibit[SEQ_LEN];
+} Seq;
+
+static void
+seq_opts(Seq *s)
+{
+	s->opt = (Options){0};
+	s->opt.lock_s = 900;
+	s->opt.off_s = 1800;
+	s->opt.suspend_s = 2700;
+	state_manager_init(&s->sm, 0);
+}
+
+/* Untouched session: idle grows by 1 s per sample through every stage. */
+static void
+seq_ramp(Seq *s)
+{
+	seq_opts(s);
+	for (size_t i = 0; i < SEQ_LEN; i++) {
+		s->raw[i] = (unsigned long)i * 1000UL;
+		s->inhibit[i] = 0;
+	}
+}
+
+/* Someone typing: short idle times with frequent resets. */
+static void
+seq_activity(Seq *s)
+{
+	seq_opts(s);
+	for (size_t i = 0; i < SEQ_LEN; i++) {
+		s->raw[i] = (unsigned long)(i % 7) * 1000UL;
+		s->inhibit[i] = 0;
+	}
+}
+
+/* Flapping player: the inhibit mask changes every few samples. */
+static void
+seq_flap(Seq *s)
+{
+	static const unsigned int masks[] = { 0, INHIBIT_AUDIO, INHIBIT_ALL, INHIBIT_AUDIO };
+
+	seq_opts(s);
+	for (size_t i = 0; i < SEQ_LEN; i++) {
+		s->raw[i] = (unsigned long)i * 1000UL;
+		s->inhibit[i] = masks[(i / 5) % 4];
+	}
+}
+
+static void
+run_update(void *ctx, unsigned long iters)
+{
+	Seq *s = ctx;
+
+	for (unsigned long i = 0; i < iters; i++) {
+		size_t k = i % SEQ_LEN;
+		State st;
+
+		/* Sequences wrap around: start over like after resume */
+		if (!k)
+			state_manager_init(&s->sm, s->raw[0]);
+
+		st = state_manager_update(&s->sm, &s->opt, s->raw[k], s->inhibit[k]);
+		if (st > s->sm.current)
+			s->sm.current = st;  /* as the main loop, minus the commands */
+		bench_sink += st;
+	}
+}
+
+static void
+run_desired(void *ctx, unsigned long iters)
+{
+	Seq *s = ctx;
+
+	for (unsigned long i = 0; i < iters; i++)
+		bench_sink += state_desired(&s->opt, i % 4000);
+}
+
+void
+bench_state(void)
+{
+	static Seq s;
+
+	seq_ramp(&s);
+	bench_run("state_desired", "0-4000s", run_desired, &s);
+	bench_run("state_manager_update", "ramp", run_update, &s);
+
+	seq_activity(&s);
+	bench_run("state_manager_update", "activity", run_update, &s);
+
+	seq_flap(&s);
+	bench_run("state_manager_update", "inhibit_flap", run_update, &s);
+}
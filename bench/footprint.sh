@@ -0,0 +1,137 @@
+#!/bin/sh
+# See LICENSE file for copyright and license details.
+#
+# Footprint per build profile: build xcoffeebreak with each set of
+# Makefile switches into a scratch directory, then report the binary's
+# size and, on Xvfb and a private session bus, its steady-state RSS.
+#
+# A profile that does not build (static without static libraries) is
+# reported with "built":false. Without Xvfb or dbus-daemon, rss_kb is
+# null and only sizes are measured.
+#
+# Output: one JSON line per profile, like make bench.
+
+set -u
+
+SETTLE=5       # s: running before RSS is read
+MAKE=${MAKE:-make}
+
+PROFILES="default
+lto
+lto MPRIS=0
+lto MPRIS=0 LOGIND=0
+static
+static MPRIS=0 LOGIND=0"
+
+usage() {
+	echo "usage: $0 [-s settle_s] [profile ...]" >&2
+	echo "       a profile is a PROFILE name followed by switches, e.g. 'lto MPRIS=0'" >&2
+	exit 2
+}
+
+while getopts s: opt; do
+	case $opt in
+	s) SETTLE=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -gt 0 ]; then
+	PROFILES=$(printf '%s\n' "$@")
+fi
+
+TMP=$(mktemp -d) || exit 2
+PIDS=
+
+cleanup() {
+	# shellcheck disable=SC2086
+	[ -n "$PIDS" ] && kill $PIDS 2>/dev/null
+	wait 2>/dev/null
+	rm -rf "$TMP"
+}
+trap cleanup EXIT INT TERM
+
+wait_for() {
+	i=0
+	while [ ! -e "$1" ]; do
+		i=$((i + 1))
+		[ $i -gt 50 ] && return 1
+		sleep 0.1
+	done
+}
+
+# --------------------------- X and D-Bus, if any -----------------------------
+
+RUN=0
+if command -v Xvfb >/dev/null 2>&1 && command -v dbus-daemon >/dev/null 2>&1; then
+	n=90
+	while [ -e "/tmp/.X11-unix/X$n" ] || [ -e "/tmp/.X$n-lock" ]; do
+		n=$((n + 1))
+	done
+
+	Xvfb ":$n" -nolisten tcp -screen 0 640x480x24 >"$TMP/xvfb.log" 2>&1 &
+	PIDS="$PIDS $!"
+
+	# shellcheck disable=SC2046
+	if wait_for "/tmp/.X11-unix/X$n" &&
+	   set -- $(dbus-daemon --session --fork --print-address=1 --print-pid=1); then
+		PIDS="$PIDS $2"
+		export DISPLAY=":$n"
+		export DBUS_SESSION_BUS_ADDRESS="$1"
+		export DBUS_SYSTEM_BUS_ADDRESS="unix:path=$TMP/no-system-bus"  # keep logind out
+		unset XDG_SESSION_ID
+		RUN=1
+	else
+		echo "$0: no X server or session bus, sizes only" >&2
+	fi
+else
+	echo "$0: Xvfb or dbus-daemon not found, sizes only" >&2
+fi
+
+# ------------------------------- profiles ------------------------------------
+
+rss_of() {
+	export XDG_RUNTIME_DIR="$1"
+	"$2" --lock_s 3600 --lock_cmd true --off_cmd true --suspend_cmd true \
+	     2>"$1/xcoffeebreak.log" &
+	pid=$!
+	RSS=null
+	if wait_for "$1/xcoffeebreak.sock"; then
+		sleep "$SETTLE"
+		RSS=$(awk '/^VmRSS:/ { print $2 }' "/proc/$pid/status" 2>/dev/null)
+		[ -n "$RSS" ] || RSS=null
+	fi
+	kill "$pid" 2>/dev/null
+	wait "$pid" 2>/dev/null
+}
+
+i=0
+echo "$PROFILES" | while read -r profile switches; do
+	[ -n "$profile" ] || continue
+	i=$((i + 1))
+	dir="$TMP/p$i"
+	mkdir -p "$dir"
+	bin="$dir/bin/xcoffeebreak"
+
+	# shellcheck disable=SC2086
+	if ! $MAKE -s COLOR=0 PROFILE="$profile" $switches \
+	     BINDIR="$dir/bin" OBJDIR="$dir/obj" "$bin" >"$dir/build.log" 2>&1; then
+		printf '{"bench":"footprint","profile":"%s","switches":"%s","built":false}\n' \
+		       "$profile" "$switches"
+		continue
+	fi
+
+	size=$(wc -c <"$bin" | tr -d ' ')
+	# shellcheck disable=SC2046
+	set -- $(size "$bin" 2>/dev/null | awk 'NR == 2 { print $1, $2, $3 }')
+	dbus=false
+	ldd "$bin" 2>/dev/null | grep -q libdbus && dbus=true
+
+	RSS=null
+	[ $RUN -eq 1 ] && rss_of "$dir" "$bin"
+
+	printf '{"bench":"footprint","profile":"%s","switches":"%s","built":true,' "$profile" "$switches"
+	printf '"file_bytes":%s,"text":%s,"data":%s,"bss":%s,' "$size" "${1:-null}" "${2:-null}" "${3:-null}"
+	printf '"libdbus":%s,"rss_kb":%s}\n' "$dbus" "$RSS"
+done
@@ -0,0 +1,13 @@
+/* See LICENSE file for copyright and license details. */
+
+#include "bench.h"
+
+int
+main(void)
+{
+	bench_state();
+	bench_mpris();
+	bench_bus();
+	bench_log();
+	return 0;
+}
@@ -0,0 +1,230 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Synthetic MPRIS player for bench/power.sh: owns a bus name, answers
+ * Get/GetAll for PlaybackStatus and Metadata, and flips between Playing
+ * and Paused every period_ms with a PropertiesChanged signal. Every
+ * status change is logged to stdout as "<unix time> P <name> <status>".
+ *
+ * usage: mpris_player name period_ms [url]
+ *        period_ms 0 keeps playing forever.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dbus/dbus.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PLAYER_IFACE "org.mpris.MediaPlayer2.Player"
+#define PROPS_IFACE  "org.freedesktop.DBus.Properties"
+#define PLAYER_PATH  "/org/mpris/MediaPlayer2"
+
+static volatile sig_atomic_t g_running = 1;
+
+static const char *g_name;
+static const char *g_url = "file:///bench/video.mp4";  /* video: blocks every stage */
+static bool g_playing = true;
+
+static unsigned long long
+now_ms(int clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (unsigned long long)ts.tv_sec * 1000ULL + (unsigned long long)ts.tv_nsec / 1000000ULL;
+}
+
+static void
+log_status(void)
+{
+	unsigned long long t = now_ms(CLOCK_REALTIME);
+
+	printf("%llu.%03llu P %s %s\n", t / 1000ULL, t % 1000ULL, g_name,
+	       g_playing ? "Playing" : "Paused");
+	fflush(stdout);
+}
+
+static void
+append_variant_string(DBusMessageIter *it, const char *s)
+{
+	DBusMessageIter var;
+
+	dbus_message_iter_open_container(it, DBUS_TYPE_VARIANT, "s", &var);
+	dbus_message_iter_append_basic(&var, DBUS_TYPE_STRING, &s);
+	dbus_message_iter_close_container(it, &var);
+}
+
+/* <a{sv}> holding xesam:url */
+static void
+append_metadata(DBusMessageIter *it)
+{
+	DBusMessageIter var, dict, entry;
+	const char *key = "xesam:url";
+
+	dbus_message_iter_open_container(it, DBUS_TYPE_VARIANT, "a{sv}", &var);
+	dbus_message_iter_open_container(&var, DBUS_TYPE_ARRAY, "{sv}", &dict);
+	dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+	append_variant_string(&entry, g_url);
+	dbus_message_iter_close_container(&dict, &entry);
+	dbus_message_iter_close_container(&var, &dict);
+	dbus_message_iter_close_container(it, &var);
+}
+
+/* {PlaybackStatus, Metadata} as a{sv}; status only if !all */
+static void
+append_props(DBusMessageIter *it, bool all)
+{
+	DBusMessageIter dict, entry;
+	const char *status = "PlaybackStatus", *metadata = "Metadata";
+
+	dbus_message_iter_open_container(it, DBUS_TYPE_ARRAY, "{sv}", &dict);
+
+	dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &status);
+	append_variant_string(&entry, g_playing ? "Playing" : "Paused");
+	dbus_message_iter_close_container(&dict, &entry);
+
+	if (all) {
+		dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+		dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &metadata);
+		append_metadata(&entry);
+		dbus_message_iter_close_container(&dict, &entry);
+	}
+
+	dbus_message_iter_close_container(it, &dict);
+}
+
+static void
+emit_changed(DBusConnection *conn)
+{
+	DBusMessageIter it, inv;
+	DBusMessage *sig;
+	const char *iface = PLAYER_IFACE;
+
+	if (!(sig = dbus_message_new_signal(PLAYER_PATH, PROPS_IFACE, "PropertiesChanged")))
+		return;
+
+	dbus_message_iter_init_append(sig, &it);
+	dbus_message_iter_append_basic(&it, DBUS_TYPE_STRING, &iface);
+	append_props(&it, false);
+	dbus_message_iter_open_container(&it, DBUS_TYPE_ARRAY, "s", &inv);
+	dbus_message_iter_close_container(&it, &inv);
+
+	dbus_connection_send(conn, sig, NULL);
+	dbus_message_unref(sig);
+}
+
+static void
+handle_call(DBusConnection *conn, DBusMessage *msg)
+{
+	DBusMessage *reply = NULL;
+	DBusMessageIter it;
+	const char *iface, *prop;
+
+	if (dbus_message_is_method_call(msg, PROPS_IFACE, "GetAll")) {
+		reply = dbus_message_new_method_return(msg);
+		dbus_message_iter_init_append(reply, &it);
+		append_props(&it, true);
+	} else if (dbus_message_is_method_call(msg, PROPS_IFACE, "Get") &&
+	           dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &iface,
+	                                 DBUS_TYPE_STRING, &prop, DBUS_TYPE_INVALID)) {
+		if (strcmp(prop, "PlaybackStatus") == 0) {
+			reply = dbus_message_new_method_return(msg);
+			dbus_message_iter_init_append(reply, &it);
+			append_variant_string(&it, g_playing ? "Playing" : "Paused");
+		} else if (strcmp(prop, "Metadata") == 0) {
+			reply = dbus_message_new_method_return(msg);
+			dbus_message_iter_init_append(reply, &it);
+			append_metadata(&it);
+		} else {
+			reply = dbus_message_new_error(msg, DBUS_ERROR_UNKNOWN_PROPERTY, prop);
+		}
+	} else if (dbus_message_get_type(msg) == DBUS_MESSAGE_TYPE_METHOD_CALL) {
+		reply = dbus_message_new_error(msg, DBUS_ERROR_UNKNOWN_METHOD, NULL);
+	}
+
+	if (reply) {
+		dbus_connection_send(conn, reply, NULL);
+		dbus_message_unref(reply);
+	}
+}
+
+static void
+sighandler(int sig)
+{
+	(void)sig;
+	g_running = 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sigaction sa = {0};
+	DBusConnection *conn;
+	DBusError err;
+	unsigned long long next_ms = 0;
+	unsigned long period_ms;
+
+	if (argc < 3) {
+		fputs("usage: mpris_player name period_ms [url]\n", stderr);
+		return 1;
+	}
+
+	g_name = argv[1];
+	period_ms = strtoul(argv[2], NULL, 10);
+	if (argc > 3)
+		g_url = argv[3];
+
+	sa.sa_handler = sighandler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	dbus_error_init(&err);
+	if (!(conn = dbus_bus_get_private(DBUS_BUS_SESSION, &err))) {
+		fprintf(stderr, "mpris_player: %s\n", err.message);
+		return 1;
+	}
+
+	if (dbus_bus_request_name(conn, g_name, DBUS_NAME_FLAG_DO_NOT_QUEUE, &err) !=
+	    DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+		fprintf(stderr, "mpris_player: cannot own %s\n", g_name);
+		return 1;
+	}
+
+	log_status();
+	if (period_ms)
+		next_ms = now_ms(CLOCK_MONOTONIC) + period_ms;
+
+	while (g_running) {
+		unsigned long long now = now_ms(CLOCK_MONOTONIC);
+		DBusMessage *msg;
+		int wait = 1000;  /* also bounds the SIGTERM reaction time */
+
+		if (next_ms && now >= next_ms) {
+			g_playing = !g_playing;
+			log_status();
+			emit_changed(conn);
+			next_ms += period_ms;
+		}
+		if (next_ms && next_ms < now + (unsigned long long)wait)
+			wait = next_ms > now ? (int)(next_ms - now) : 0;
+
+		if (!dbus_connection_read_write(conn, wait))
+			break;
+
+		while ((msg = dbus_connection_pop_message(conn))) {
+			handle_call(conn, msg);
+			dbus_message_unref(msg);
+		}
+	}
+
+	dbus_connection_close(conn);
+	dbus_connection_unref(conn);
+	return 0;
+}
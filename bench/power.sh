@@ -0,0 +1,184 @@
+#!/bin/sh
+# See LICENSE file for copyright and license details.
+#
+# End-to-end power benchmark: run xcoffeebreak on Xvfb and a private
+# session bus next to synthetic MPRIS players, then report its wakeups,
+# CPU time and RSS, and check its transitions against the players.
+#
+# Players play video (blocking every stage) and flip Playing/Paused every
+# flip_ms, all in phase. A stage entered while a player is playing is a
+# violation; a paused stretch long enough for the next stage that ends
+# without it is a missed transition. Either makes the exit status 1.
+#
+# Output: one JSON line, like make bench.
+
+set -u
+
+DURATION=60    # seconds measured
+PLAYERS=1
+FLIP_MS=10000  # 0: players never pause
+LOCK_S=3
+BIN=bin/xcoffeebreak
+PLAYER=bin/mpris_player
+SLACK=2        # s: poll interval plus signal delivery
+
+usage() {
+	echo "usage: $0 [-d seconds] [-n players] [-f flip_ms] [-l lock_s] [-b xcoffeebreak] [-p mpris_player]" >&2
+	exit 2
+}
+
+while getopts d:n:f:l:b:p: opt; do
+	case $opt in
+	d) DURATION=$OPTARG ;;
+	n) PLAYERS=$OPTARG ;;
+	f) FLIP_MS=$OPTARG ;;
+	l) LOCK_S=$OPTARG ;;
+	b) BIN=$OPTARG ;;
+	p) PLAYER=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+
+OFF_S=$((LOCK_S * 2))
+SUSPEND_S=$((LOCK_S * 3))
+
+for tool in Xvfb dbus-daemon "$BIN" "$PLAYER"; do
+	command -v "$tool" >/dev/null 2>&1 || { echo "$0: $tool not found" >&2; exit 2; }
+done
+
+TMP=$(mktemp -d) || exit 2
+PIDS=
+
+cleanup() {
+	# shellcheck disable=SC2086
+	[ -n "$PIDS" ] && kill $PIDS 2>/dev/null
+	wait 2>/dev/null
+	rm -rf "$TMP"
+}
+trap cleanup EXIT INT TERM
+
+wait_for() {
+	i=0
+	while [ ! -e "$1" ]; do
+		i=$((i + 1))
+		[ $i -gt 50 ] && { echo "$0: timed out waiting for $1" >&2; exit 2; }
+		sleep 0.1
+	done
+}
+
+# ---------------------------------- X ----------------------------------------
+
+n=90
+while [ -e "/tmp/.X11-unix/X$n" ] || [ -e "/tmp/.X$n-lock" ]; do
+	n=$((n + 1))
+done
+
+Xvfb ":$n" -nolisten tcp -screen 0 640x480x24 >"$TMP/xvfb.log" 2>&1 &
+PIDS="$PIDS $!"
+wait_for "/tmp/.X11-unix/X$n"
+
+# -------------------------------- D-Bus --------------------------------------
+
+# shellcheck disable=SC2046
+set -- $(dbus-daemon --session --fork --print-address=1 --print-pid=1) || exit 2
+PIDS="$PIDS $2"
+
+export DISPLAY=":$n"
+export DBUS_SESSION_BUS_ADDRESS="$1"
+export DBUS_SYSTEM_BUS_ADDRESS="unix:path=$TMP/no-system-bus"  # keep logind out
+export XDG_RUNTIME_DIR="$TMP"
+unset XDG_SESSION_ID
+
+# ------------------------------- players -------------------------------------
+
+i=0
+while [ $i -lt "$PLAYERS" ]; do
+	"$PLAYER" "org.mpris.MediaPlayer2.bench$i" "$FLIP_MS" >"$TMP/player$i.log" &
+	PIDS="$PIDS $!"
+	i=$((i + 1))
+done
+sleep 0.5
+
+# ----------------------------- xcoffeebreak ----------------------------------
+
+"$BIN" --lock_s "$LOCK_S" --off_s "$OFF_S" --suspend_s "$SUSPEND_S" \
+       --lock_cmd true --off_cmd true --suspend_cmd true 2>"$TMP/xcoffeebreak.log" &
+XCB=$!
+PIDS="$PIDS $XCB"
+wait_for "$TMP/xcoffeebreak.sock"
+
+# Timestamp every pushed state line
+"$BIN" --ctl subscribe | while read -r line; do
+	echo "$(date +%s.%N) S $line"
+done >"$TMP/states.log" &
+PIDS="$PIDS $!"
+
+sample() {
+	# schedstat: ns on cpu, ns waiting, timeslices (one per wakeup)
+	read -r CPU_NS _ SLICES <"/proc/$XCB/schedstat"
+}
+
+START=$(date +%s.%N)
+sample
+CPU0=$CPU_NS
+SLICES0=$SLICES
+
+sleep "$DURATION"
+
+sample
+END=$(date +%s.%N)
+RSS_KB=$(awk '/^VmRSS:/ { print $2 }' "/proc/$XCB/status")
+HWM_KB=$(awk '/^VmHWM:/ { print $2 }' "/proc/$XCB/status")
+
+# ------------------------------- report --------------------------------------
+
+cat "$TMP"/player*.log "$TMP/states.log" 2>/dev/null | sort -n -k1,1 | awk \
+	-v start="$START" -v end="$END" -v players="$PLAYERS" -v slack="$SLACK" \
+	-v lock_s="$LOCK_S" -v off_s="$OFF_S" -v suspend_s="$SUSPEND_S" \
+	-v cpu_ns=$((CPU_NS - CPU0)) -v slices=$((SLICES - SLICES0)) \
+	-v rss="$RSS_KB" -v hwm="$HWM_KB" -v flip="$FLIP_MS" '
+function stage_for(s) {
+	return s >= suspend_s ? 3 : s >= off_s ? 2 : s >= lock_s ? 1 : 0
+}
+# A paused stretch [t0, t1]: the stage its length allows must be reached
+function close_window(t0, t1) {
+	if (t0 >= 0 && cur < stage_for(t1 - t0 - slack))
+		missed++
+}
+BEGIN {
+	stage["ACTIVE"] = 0; stage["LOCKED"] = 1; stage["OFF"] = 2; stage["SUSPENDED"] = 3
+	win = players ? -1 : start
+	last_play = 0
+}
+$2 == "P" {
+	if ($4 == "Playing" && !on[$3]) {
+		on[$3] = 1
+		if (++playing == 1) {
+			close_window(win, $1)
+			win = -1
+		}
+		last_play = $1
+	} else if ($4 == "Paused" && on[$3]) {
+		on[$3] = 0
+		if (--playing == 0)
+			win = $1
+	}
+}
+$2 == "S" && split($3, kv, "=") == 2 && kv[1] == "state" {
+	st = stage[kv[2]]
+	if (st > cur) {
+		transitions++
+		if (playing && $1 - last_play > slack)
+			violations++
+	}
+	cur = st
+}
+END {
+	if (!playing)
+		close_window(win, end)
+	secs = end - start
+	printf "{\"bench\":\"power\",\"players\":%d,\"flip_ms\":%d,\"duration_s\":%.1f,", players, flip, secs
+	printf "\"wakeups_per_min\":%.1f,\"cpu_ms\":%.2f,\"cpu_pct\":%.4f,", slices * 60 / secs, cpu_ns / 1e6, cpu_ns / 1e7 / secs
+	printf "\"rss_kb\":%d,\"hwm_kb\":%d,\"transitions\":%d,\"violations\":%d,\"missed\":%d}\n", rss, hwm, transitions, violations, missed
+	exit (violations || missed)
+}'
@@ -0,0 +1,302 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Replay a session bus capture through the MPRIS layer.
+ *
+ * Record with:  dbus-monitor --session --pcap > capture.pcap
+ * Replay with:  replay [-a] [-f] [-v] capture.pcap
+ *
+ * Signals are sent over a private peer connection (so their original
+ * senders are kept) to a bare Mpris, and every one goes through
+ * dispatch_all_messages() like on the live bus. Only signals the
+ * daemon's match rules would deliver are replayed unless -a is given.
+ * Timing follows the capture unless -f (flat out) is given.
+ *
+ * Players that were already running when the capture started never
+ * show up in NameOwnerChanged; their senders are adopted as players the
+ * first time they emit an MPRIS PropertiesChanged.
+ *
+ * Output: JSON lines, a summary with per-message dispatch cost, then
+ * the final state of every player.
+ */
+
+#include "../mpris.c"
+
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define PCAP_MAGIC      0xa1b2c3d4u
+#define PCAP_MAGIC_NS   0xa1b23c4du
+#define PCAP_LINK_DBUS  231
+#define REPLAY_WAIT_MS  1000  /* for one message to arrive */
+
+typedef struct {
+	FILE *f;
+	bool swap;
+	bool nsec;
+} Pcap;
+
+/* ---------------------------------- pcap --------------------------------- */
+
+static unsigned int
+u32(const unsigned char *b, bool swap)
+{
+	unsigned int v;
+
+	memcpy(&v, b, 4);
+	if (swap)
+		v = (v >> 24) | ((v >> 8) & 0xff00u) | ((v << 8) & 0xff0000u) | (v << 24);
+	return v;
+}
+
+static int
+pcap_open(Pcap *p, const char *path)
+{
+	unsigned char hdr[24];
+	unsigned int magic;
+
+	if (!(p->f = fopen(path, "rb"))) {
+		warn("%s:", path);
+		return -1;
+	}
+
+	if (fread(hdr, 1, sizeof(hdr), p->f) != sizeof(hdr)) {
+		warn("%s: short pcap header", path);
+		return -1;
+	}
+
+	magic = u32(hdr, false);
+	p->swap = magic != PCAP_MAGIC && magic != PCAP_MAGIC_NS;
+	magic = u32(hdr, p->swap);
+	if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NS) {
+		warn("%s: not a pcap file", path);
+		return -1;
+	}
+	p->nsec = magic == PCAP_MAGIC_NS;
+
+	if (u32(hdr + 20, p->swap) != PCAP_LINK_DBUS) {
+		warn("%s: link type %u, not D-Bus", path, u32(hdr + 20, p->swap));
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Next record into *buf (grown as needed).
+ * Returns its length, 0 at the end, -1 on a truncated file.
+ */
+static long
+pcap_next(Pcap *p, unsigned char **buf, size_t *cap, unsigned long long *ts_us)
+{
+	unsigned char rec[16];
+	unsigned int len;
+	size_t n;
+
+	if ((n = fread(rec, 1, sizeof(rec), p->f)) == 0)
+		return 0;
+	if (n != sizeof(rec))
+		return -1;
+
+	*ts_us = (unsigned long long)u32(rec, p->swap) * 1000000ULL +
+	         (p->nsec ? u32(rec + 4, p->swap) / 1000u : u32(rec + 4, p->swap));
+	len = u32(rec + 8, p->swap);
+
+	if (len > *cap) {
+		unsigned char *nb = realloc(*buf, len);
+
+		if (!nb)
+			die("realloc:");
+		*buf = nb;
+		*cap = len;
+	}
+
+	if (fread(*buf, 1, len, p->f) != len)
+		return -1;
+
+	return (long)len;
+}
+
+/* -------------------------------- replay --------------------------------- */
+
+/* What the daemon's match rules (see mpris_connect()) let through. */
+static bool
+matched(DBusMessage *msg)
+{
+	const char *iface = NULL;
+
+	if (dbus_message_is_signal(msg, "org.freedesktop.DBus", "NameOwnerChanged"))
+		return dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &iface, DBUS_TYPE_INVALID) &&
+		       strncmp(iface, "org.mpris.MediaPlayer2.", 23) == 0;
+
+	return dbus_message_is_signal(msg, "org.freedesktop.DBus.Properties", "PropertiesChanged") &&
+	       dbus_message_has_path(msg, "/org/mpris/MediaPlayer2") &&
+	       dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &iface, DBUS_TYPE_INVALID) &&
+	       streq(iface, "org.mpris.MediaPlayer2.Player");
+}
+
+/* A player that predates the capture: known only by its unique name. */
+static void
+adopt_sender(Mpris *m, DBusMessage *msg)
+{
+	const char *sender = dbus_message_get_sender(msg);
+	char name[128];
+	Player *p;
+
+	if (!sender || !dbus_message_has_path(msg, "/org/mpris/MediaPlayer2") ||
+	    !dbus_message_is_signal(msg, "org.freedesktop.DBus.Properties", "PropertiesChanged") ||
+	    player_find_by_owner(m->players, sender))
+		return;
+
+	snprintf(name, sizeof(name), "org.mpris.MediaPlayer2.capture%s", sender);
+	if ((p = player_add(m, name)))
+		player_set_owner(m, p, sender);
+}
+
+/* Sleep until offset_us after base_ns. */
+static void
+sleep_until(unsigned long long base_ns, unsigned long long offset_us)
+{
+	unsigned long long target = base_ns + offset_us * 1000ULL, now = bench_now_ns();
+	struct timespec ts;
+
+	if (target <= now)
+		return;
+
+	ts.tv_sec = (time_t)((target - now) / 1000000000ULL);
+	ts.tv_nsec = (long)((target - now) % 1000000000ULL);
+	nanosleep(&ts, NULL);
+}
+
+static int
+cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long long ts_us, ts0_us = 0, start_ns, *cost = NULL, total_ns = 0;
+	size_t records = 0, replayed = 0, skipped = 0, bad = 0, cap = 0, ncost = 0, capcost = 0;
+	bool all = false, flat = false;
+	unsigned char *buf = NULL;
+	Mpris m = {0};
+	BenchServer srv;
+	DBusConnection *conn;
+	Pcap p = {0};
+	long len;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "afv")) != -1) {
+		switch (opt) {
+		case 'a': all = true;      break;
+		case 'f': flat = true;     break;
+		case 'v': m.verbose = true; break;
+		default:  optind = argc + 1; break;
+		}
+	}
+
+	if (optind != argc - 1) {
+		fputs("usage: replay [-a] [-f] [-v] capture.pcap\n", stderr);
+		return 1;
+	}
+
+	if (pcap_open(&p, argv[optind]) < 0)
+		return 1;
+
+	bench_server_open(&srv);
+	m.conn = conn = bench_server_connect(&srv, true);
+	if (!dbus_connection_add_filter(m.conn, mpris_filter, &m, NULL))
+		die("add_filter failed");
+
+	start_ns = bench_now_ns();
+
+	while ((len = pcap_next(&p, &buf, &cap, &ts_us)) > 0) {
+		DBusMessage *msg;
+		DBusError err;
+		size_t before;
+		unsigned long long ns = 0;
+
+		records++;
+		dbus_error_init(&err);
+		if (!(msg = dbus_message_demarshal((const char *)buf, (int)len, &err))) {
+			dbus_error_free(&err);
+			bad++;
+			continue;
+		}
+
+		if (dbus_message_get_type(msg) != DBUS_MESSAGE_TYPE_SIGNAL || (!all && !matched(msg))) {
+			dbus_message_unref(msg);
+			skipped++;
+			continue;
+		}
+
+		if (!ts0_us)
+			ts0_us = ts_us;
+		if (!flat)
+			sleep_until(start_ns, ts_us - ts0_us);
+
+		adopt_sender(&m, msg);
+
+		before = m.nmsgs;
+		if (!dbus_connection_send(srv.peer, msg, NULL))
+			die("dbus_connection_send failed");
+		dbus_message_unref(msg);
+		dbus_connection_flush(srv.peer);
+
+		/* Only the dispatch is timed, not the socket in between */
+		for (int i = 0; m.nmsgs == before && i < REPLAY_WAIT_MS; i++) {
+			unsigned long long t0;
+
+			dbus_connection_read_write(conn, 1);
+			t0 = bench_now_ns();
+			(void)dispatch_all_messages(&m);
+			ns += bench_now_ns() - t0;
+		}
+
+		if (m.nmsgs == before) {
+			warn("message %zu never arrived", records);
+			break;
+		}
+
+		if (ncost == capcost) {
+			capcost = capcost ? capcost * 2 : 1024;
+			if (!(cost = realloc(cost, capcost * sizeof(*cost))))
+				die("realloc:");
+		}
+		cost[ncost++] = ns;
+		total_ns += ns;
+		replayed++;
+	}
+
+	if (len < 0)
+		warn("%s: truncated record", argv[optind]);
+
+	qsort(cost, ncost, sizeof(*cost), cmp_ull);
+	printf("{\"capture\":\"%s\",\"records\":%zu,\"replayed\":%zu,\"skipped\":%zu,\"bad\":%zu,"
+	       "\"wall_s\":%.3f,\"ns_mean\":%.0f,\"ns_p50\":%llu,\"ns_p99\":%llu,\"ns_max\":%llu,"
+	       "\"playing_count\":%u,\"inhibit_mask\":%u}\n",
+	       argv[optind], records, replayed, skipped, bad, (double)(bench_now_ns() - start_ns) / 1e9,
+	       ncost ? (double)total_ns / (double)ncost : 0.0,
+	       ncost ? cost[ncost / 2] : 0, ncost ? cost[ncost * 99 / 100] : 0,
+	       ncost ? cost[ncost - 1] : 0, m.playing_count, mpris_inhibit_mask(&m));
+
+	for (Player *pl = m.players; pl; pl = pl->next)
+		printf("{\"player\":\"%s\",\"owner\":\"%s\",\"playing\":%s,\"media\":\"%s\"}\n",
+		       pl->name, pl->owner, pl->is_playing ? "true" : "false",
+		       media_names[pl->media]);
+
+	dbus_connection_remove_filter(m.conn, mpris_filter, &m);
+	players_clear(&m);
+	bench_conn_close(conn);
+	bench_server_close(&srv);
+	fclose(p.f);
+	free(cost);
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,629 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <dbus/dbus.h>
+#include <poll.h>
+#include <stdlib.h>
+#include "bus.h"
+#include "utils.h"
+
+#define BUS_FD_MAX_WATCHES 4  /* watches handled per ready fd and round */
+#define BUS_SYSTEM_ADDRESS "unix:path=/var/run/dbus/system_bus_socket"
+
+typedef struct WatchEnt {
+	DBusWatch *watch;
+	int fd;
+} WatchEnt;
+
+typedef struct TimeoutEnt {
+	DBusTimeout *timeout;
+	unsigned long long deadline_ms;
+} TimeoutEnt;
+
+struct Bus {
+	DBusBusType type;
+	DBusConnection *conn;    /* NULL while disconnected */
+	DBusPendingCall *hello;  /* until the bus assigns our unique name */
+
+	WatchEnt watches[BUS_MAX_WATCHES];
+	size_t nwatches;
+
+	/* one entry per fd with an enabled watch, see pfd_sync() */
+	struct pollfd pfds[BUS_MAX_WATCHES];
+	size_t npfds;
+
+	/* enabled timeouts, binary min-heap on deadline_ms */
+	TimeoutEnt timeouts[BUS_MAX_TIMEOUTS];
+	size_t ntimeouts;
+};
+
+static short
+dbus_flags_to_poll(unsigned int flags)
+{
+	short ev = 0;
+
+	if (flags & DBUS_WATCH_READABLE)
+		ev |= POLLIN;
+	if (flags & DBUS_WATCH_WRITABLE)
+		ev |= POLLOUT;
+	return ev;
+}
+
+static unsigned int
+poll_revents_to_dbus(short revents)
+{
+	unsigned int flags = 0;
+
+	if (revents & POLLIN)
+		flags |= DBUS_WATCH_READABLE;
+	if (revents & POLLOUT)
+		flags |= DBUS_WATCH_WRITABLE;
+	if (revents & POLLERR)
+		flags |= DBUS_WATCH_ERROR;
+	if (revents & POLLHUP)
+		flags |= DBUS_WATCH_HANGUP;
+	return flags;
+}
+
+/* ------------------------------ pollfd set ------------------------------- */
+
+static size_t
+pfd_index(const Bus *b, int fd)
+{
+	for (size_t i = 0; i < b->npfds; i++)
+		if (b->pfds[i].fd == fd)
+			return i;
+	return (size_t)-1;
+}
+
+/*
+ * Recompute the pollfd entry for fd from its watches: add it when the
+ * first watch gets enabled, drop it when the last one is disabled or
+ * removed. Called from the watch callbacks only.
+ */
+static void
+pfd_sync(Bus *b, int fd)
+{
+	size_t idx;
+	short ev = 0;
+	bool enabled = false;
+
+	for (size_t i = 0; i < b->nwatches; i++) {
+		if (b->watches[i].fd != fd || !dbus_watch_get_enabled(b->watches[i].watch))
+			continue;
+		enabled = true;
+		ev |= dbus_flags_to_poll(dbus_watch_get_flags(b->watches[i].watch));
+	}
+
+	idx = pfd_index(b, fd);
+
+	if (!enabled) {
+		if (idx != (size_t)-1)
+			b->pfds[idx] = b->pfds[--b->npfds];
+		return;
+	}
+
+	if (idx == (size_t)-1) {
+		/* never full: no more fds than watches */
+		idx = b->npfds++;
+		b->pfds[idx].fd = fd;
+	}
+
+	b->pfds[idx].events = ev;
+	b->pfds[idx].revents = 0;
+}
+
+/* ---------------------------- libdbus watches ---------------------------- */
+
+static int
+watch_index_by_ptr(Bus *b, DBusWatch *w)
+{
+	for (size_t i = 0; i < b->nwatches; i++)
+		if (b->watches[i].watch == w)
+			return (int)i;
+	return -1;
+}
+
+static dbus_bool_t
+watch_add(DBusWatch *watch, void *data)
+{
+	Bus *b = (Bus *)data;
+	int fd;
+
+	if (watch_index_by_ptr(b, watch) >= 0)
+		return TRUE;
+
+	if (b->nwatches == BUS_MAX_WATCHES) {
+		warn("[DBUS] more than %d watches", BUS_MAX_WATCHES);
+		return FALSE;
+	}
+
+	fd = dbus_watch_get_unix_fd(watch);
+	b->watches[b->nwatches].watch = watch;
+	b->watches[b->nwatches].fd = fd;
+	b->nwatches++;
+
+	pfd_sync(b, fd);
+	return TRUE;
+}
+
+static void
+watch_remove(DBusWatch *watch, void *data)
+{
+	Bus *b;
+	int idx, fd;
+
+	b = (Bus *)data;
+	idx = watch_index_by_ptr(b, watch);
+
+	if (idx < 0)
+		return;
+
+	fd = b->watches[idx].fd;
+	b->watches[idx] = b->watches[b->nwatches - 1];
+	b->nwatches--;
+
+	pfd_sync(b, fd);
+}
+
+static void
+watch_toggle(DBusWatch *watch, void *data)
+{
+	Bus *b;
+	int idx;
+
+	b = (Bus *)data;
+	idx = watch_index_by_ptr(b, watch);
+
+	if (idx < 0)
+		return;
+
+	pfd_sync(b, b->watches[idx].fd);
+}
+
+/* --------------------------- libdbus timeouts --------------------------- */
+
+static void
+heap_swap(Bus *b, size_t i, size_t j)
+{
+	TimeoutEnt t = b->timeouts[i];
+
+	b->timeouts[i] = b->timeouts[j];
+	b->timeouts[j] = t;
+}
+
+static void
+heap_up(Bus *b, size_t i)
+{
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+
+		if (b->timeouts[parent].deadline_ms <= b->timeouts[i].deadline_ms)
+			break;
+		heap_swap(b, i, parent);
+		i = parent;
+	}
+}
+
+static void
+heap_down(Bus *b, size_t i)
+{
+	for (;;) {
+		size_t l = 2 * i + 1, r = l + 1, min = i;
+
+		if (l < b->ntimeouts && b->timeouts[l].deadline_ms < b->timeouts[min].deadline_ms)
+			min = l;
+		if (r < b->ntimeouts && b->timeouts[r].deadline_ms < b->timeouts[min].deadline_ms)
+			min = r;
+		if (min == i)
+			break;
+		heap_swap(b, i, min);
+		i = min;
+	}
+}
+
+static int
+heap_push(Bus *b, DBusTimeout *t)
+{
+	int interval;
+
+	if (b->ntimeouts == BUS_MAX_TIMEOUTS)
+		return -1;
+
+	interval = dbus_timeout_get_interval(t);
+	b->timeouts[b->ntimeouts].timeout = t;
+	b->timeouts[b->ntimeouts].deadline_ms = monotonic_ms() + (unsigned long long)(interval > 0 ? interval : 0);
+	heap_up(b, b->ntimeouts++);
+	return 0;
+}
+
+static void
+heap_remove(Bus *b, DBusTimeout *t)
+{
+	for (size_t i = 0; i < b->ntimeouts; i++) {
+		if (b->timeouts[i].timeout != t)
+			continue;
+
+		b->timeouts[i] = b->timeouts[--b->ntimeouts];
+		if (i < b->ntimeouts) {
+			heap_up(b, i);
+			heap_down(b, i);
+		}
+		return;
+	}
+}
+
+static dbus_bool_t
+timeout_add(DBusTimeout *timeout, void *data)
+{
+	Bus *b = (Bus *)data;
+
+	if (!dbus_timeout_get_enabled(timeout))
+		return TRUE;
+
+	heap_remove(b, timeout);
+	if (heap_push(b, timeout)) {
+		warn("[DBUS] more than %d timeouts (timeout_add)", BUS_MAX_TIMEOUTS);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+timeout_remove(DBusTimeout *timeout, void *data)
+{
+	heap_remove((Bus *)data, timeout);
+}
+
+static void
+timeout_toggle(DBusTimeout *timeout, void *data)
+{
+	Bus *b = (Bus *)data;
+
+	/* Re-enabling restarts the interval, as libdbus expects */
+	heap_remove(b, timeout);
+	if (dbus_timeout_get_enabled(timeout) && heap_push(b, timeout))
+		warn("[DBUS] more than %d timeouts (timeout_toggle)", BUS_MAX_TIMEOUTS);
+}
+
+/*
+ * Fire expired timeouts. Each one is re-armed for its next interval
+ * before the handler runs, since the handler may remove or toggle it.
+ */
+static void
+handle_timeouts(Bus *b)
+{
+	unsigned long long now_ms;
+
+	if (!b->ntimeouts)
+		return;
+
+	now_ms = monotonic_ms();
+
+	while (b->ntimeouts && b->timeouts[0].deadline_ms <= now_ms) {
+		DBusTimeout *t = b->timeouts[0].timeout;
+		int interval = dbus_timeout_get_interval(t);
+
+		b->timeouts[0].deadline_ms = now_ms + (unsigned long long)(interval > 0 ? interval : 1);
+		heap_down(b, 0);
+
+		dbus_timeout_handle(t);
+	}
+}
+
+/*
+ * Dispatch revents for one fd to the watches on it. Handling a watch
+ * may add, remove or toggle watches, so the candidates are collected
+ * first and each one is looked up again before use.
+ */
+static void
+handle_fd(Bus *b, int fd, short revents)
+{
+	DBusWatch *ws[BUS_FD_MAX_WATCHES];
+	size_t nws = 0;
+
+	for (size_t i = 0; i < b->nwatches && nws < BUS_FD_MAX_WATCHES; i++)
+		if (b->watches[i].fd == fd)
+			ws[nws++] = b->watches[i].watch;
+
+	for (size_t i = 0; i < nws; i++) {
+		unsigned int wflags, all_flags, masked;
+
+		if (watch_index_by_ptr(b, ws[i]) < 0 || !dbus_watch_get_enabled(ws[i]))
+			continue;
+
+		wflags    = dbus_watch_get_flags(ws[i]);
+		all_flags = poll_revents_to_dbus(revents);
+
+		/*
+		 * Only deliver READABLE/WRITABLE if the watch asked for them.
+		 * Always deliver ERROR/HANGUP when present.
+		 */
+		masked = (all_flags & (DBUS_WATCH_ERROR | DBUS_WATCH_HANGUP)) |
+		         (all_flags & wflags);
+
+		if (masked)
+			dbus_watch_handle(ws[i], masked);
+	}
+}
+
+/* ---------------------------- connection setup --------------------------- */
+
+static void
+bus_disconnect(Bus *b)
+{
+	if (!b->conn)
+		return;
+
+	if (b->hello) {
+		dbus_pending_call_cancel(b->hello);
+		dbus_pending_call_unref(b->hello);
+		b->hello = NULL;
+	}
+
+	/* Detach first so libdbus never calls back into freed memory */
+	dbus_connection_set_watch_functions(b->conn, NULL, NULL, NULL, NULL, NULL);
+	dbus_connection_set_timeout_functions(b->conn, NULL, NULL, NULL, NULL, NULL);
+	dbus_connection_close(b->conn);
+	dbus_connection_unref(b->conn);
+	b->conn = NULL;
+
+	/* The remove callbacks emptied these */
+	b->nwatches = b->npfds = b->ntimeouts = 0;
+}
+
+static void
+hello_notify(DBusPendingCall *pc, void *data)
+{
+	Bus *b = (Bus *)data;
+	DBusMessage *reply;
+	const char *name;
+
+	reply = dbus_pending_call_steal_reply(pc);
+	dbus_pending_call_unref(pc);
+	b->hello = NULL;
+
+	if (!reply)
+		return;
+
+	if (dbus_message_get_args(reply, NULL, DBUS_TYPE_STRING, &name, DBUS_TYPE_INVALID))
+		dbus_bus_set_unique_name(b->conn, name);
+	else
+		warn("[DBUS] Hello failed: %s",
+		     dbus_message_get_error_name(reply) ? dbus_message_get_error_name(reply) : "bad reply");
+
+	dbus_message_unref(reply);
+}
+
+/*
+ * Open the bus socket and queue Hello instead of waiting for it like
+ * dbus_bus_get_private() does; the bus handles our later calls in
+ * order, so they may follow right away. Only a session bus without
+ * DBUS_SESSION_BUS_ADDRESS (autolaunch) still takes the blocking path.
+ */
+static DBusConnection *
+bus_open_conn(const Bus *b, bool *registered, DBusError *err)
+{
+	const char *addr;
+
+	addr = getenv(b->type == DBUS_BUS_SYSTEM ? "DBUS_SYSTEM_BUS_ADDRESS" : "DBUS_SESSION_BUS_ADDRESS");
+	if (!addr || !*addr) {
+		if (b->type != DBUS_BUS_SYSTEM) {
+			*registered = true;
+			return dbus_bus_get_private(b->type, err);
+		}
+		addr = BUS_SYSTEM_ADDRESS;
+	}
+
+	*registered = false;
+	return dbus_connection_open_private(addr, err);
+}
+
+static int
+bus_send_hello(Bus *b)
+{
+	DBusMessage *msg;
+	DBusPendingCall *pc = NULL;
+
+	msg = dbus_message_new_method_call(DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "Hello");
+	if (!msg)
+		return -1;
+
+	if (!dbus_connection_send_with_reply(b->conn, msg, &pc, DBUS_TIMEOUT_USE_DEFAULT) || !pc) {
+		dbus_message_unref(msg);
+		return -1;
+	}
+	dbus_message_unref(msg);
+
+	if (!dbus_pending_call_set_notify(pc, hello_notify, b, NULL)) {
+		dbus_pending_call_cancel(pc);
+		dbus_pending_call_unref(pc);
+		return -1;
+	}
+
+	b->hello = pc;
+	return 0;
+}
+
+/*
+ * Private (unshared) connection, so a dead one can be closed and
+ * replaced without libdbus handing the stale one back.
+ */
+static int
+bus_connect(Bus *b)
+{
+	DBusError err;
+	bool registered;
+
+	dbus_error_init(&err);
+
+	b->conn = bus_open_conn(b, &registered, &err);
+	if (!b->conn) {
+		warn("[DBUS] cannot connect to the bus: %s", err.message ? err.message : "unknown error");
+		dbus_error_free(&err);
+		return -1;
+	}
+
+	/* Connection loss is reported through bus_handle(), never exit() */
+	dbus_connection_set_exit_on_disconnect(b->conn, FALSE);
+
+	if (!dbus_connection_set_watch_functions(b->conn, watch_add, watch_remove, watch_toggle, b, NULL)) {
+		warn("[DBUS] set_watch_functions failed");
+		bus_disconnect(b);
+		return -1;
+	}
+
+	if (!dbus_connection_set_timeout_functions(b->conn, timeout_add, timeout_remove, timeout_toggle, b, NULL)) {
+		warn("[DBUS] set_timeout_functions failed");
+		bus_disconnect(b);
+		return -1;
+	}
+
+	/* After the timeout functions, so Hello's timeout lands in our table */
+	if (!registered && bus_send_hello(b) < 0) {
+		warn("[DBUS] cannot send Hello");
+		bus_disconnect(b);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+match_notify(DBusPendingCall *pc, void *data)
+{
+	DBusMessage *reply;
+	const char *what = (const char *)data;
+
+	reply = dbus_pending_call_steal_reply(pc);
+	dbus_pending_call_unref(pc);
+
+	if (!reply)
+		return;
+
+	if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR)
+		warn("%s failed: %s", what, dbus_message_get_error_name(reply));
+
+	dbus_message_unref(reply);
+}
+
+/* ------------------------------- Bus public ------------------------------ */
+
+Bus *
+bus_open(DBusBusType type)
+{
+	Bus *b;
+
+	b = calloc(1, sizeof(*b));
+	if (!b) {
+		warn("[DBUS] calloc failed");
+		return NULL;
+	}
+
+	b->type = type;
+
+	if (bus_connect(b) < 0) {
+		bus_close(b);
+		return NULL;
+	}
+
+	return b;
+}
+
+int
+bus_reconnect(Bus *b)
+{
+	if (!b)
+		return -1;
+
+	bus_disconnect(b);
+	return bus_connect(b);
+}
+
+void
+bus_close(Bus *b)
+{
+	if (!b)
+		return;
+
+	bus_disconnect(b);
+	free(b);
+}
+
+DBusConnection *
+bus_conn(const Bus *b)
+{
+	return b ? b->conn : NULL;
+}
+
+int
+bus_timeout_ms(const Bus *b)
+{
+	unsigned long long now_ms;
+
+	if (!b || !b->ntimeouts)
+		return -1;
+
+	now_ms = monotonic_ms();
+	if (b->timeouts[0].deadline_ms <= now_ms)
+		return 0;
+
+	return (int)(b->timeouts[0].deadline_ms - now_ms);
+}
+
+size_t
+bus_pollfds(const Bus *b, const struct pollfd **pfds)
+{
+	*pfds = b->pfds;
+	if (!b->conn)
+		return 0;
+	return b->npfds;
+}
+
+int
+bus_handle(Bus *b, const struct pollfd *pfds, size_t n)
+{
+	if (!b || !b->conn || !dbus_connection_get_is_connected(b->conn))
+		return -1;
+
+	for (size_t i = 0; i < n; i++)
+		if (pfds[i].revents)
+			handle_fd(b, pfds[i].fd, pfds[i].revents);
+
+	handle_timeouts(b);
+
+	/* Move queued outgoing data and parse anything read above */
+	dbus_connection_read_write(b->conn, 0);
+
+	return dbus_connection_get_is_connected(b->conn) ? 0 : -1;
+}
+
+int
+bus_add_match(DBusConnection *conn, const char *rule, const char *what)
+{
+	DBusMessage *msg;
+	DBusPendingCall *pc = NULL;
+
+	if (!conn)
+		return -1;
+
+	msg = dbus_message_new_method_call(DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "AddMatch");
+	if (!msg)
+		return -1;
+
+	if (!dbus_message_append_args(msg, DBUS_TYPE_STRING, &rule, DBUS_TYPE_INVALID) ||
+	    !dbus_connection_send_with_reply(conn, msg, &pc, DBUS_TIMEOUT_USE_DEFAULT) || !pc) {
+		dbus_message_unref(msg);
+		return -1;
+	}
+	dbus_message_unref(msg);
+
+	/* what is a string literal, fine as notify data */
+	if (!dbus_pending_call_set_notify(pc, match_notify, (void *)what, NULL)) {
+		dbus_pending_call_cancel(pc);
+		dbus_pending_call_unref(pc);
+		return -1;
+	}
+
+	return 0;
+}
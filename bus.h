@@ -0,0 +1,85 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef XCOFFEEBREAK_BUS_H
+#define XCOFFEEBREAK_BUS_H
+
+#include <dbus/dbus.h>
+#include <poll.h>
+#include <stddef.h>
+
+/*
+ * Upper bounds of the handle's tables, all part of it: no allocation
+ * after bus_open(). libdbus uses two watches per connection and one
+ * timeout per pending call; past these, it sees an out of memory
+ * error and fails the call.
+ */
+#ifndef BUS_MAX_WATCHES
+#define BUS_MAX_WATCHES  8
+#endif
+#define BUS_MAX_TIMEOUTS 256
+
+typedef struct Bus Bus;
+
+/*
+ * Connect to a message bus and take over its watches. Hello is queued,
+ * not waited for (except for an autolaunched session bus).
+ *
+ * Returns an initialized structure on success,
+ * NULL on failiure.
+ */
+Bus *bus_open(DBusBusType type);
+
+/*
+ * Drop the current connection (dead or not) and connect again. The
+ * handle stays valid; filters, matches and names must be set up again
+ * by the caller.
+ *
+ * Returns 0 on success, -1 on failure (the handle is then disconnected
+ * until the next successful call).
+ */
+int bus_reconnect(Bus *b);
+
+/* Close and free a bus handle (safe to call with NULL). */
+void bus_close(Bus *b);
+
+/* Underlying connection, owned by the handle; NULL while disconnected. */
+DBusConnection *bus_conn(const Bus *b);
+
+/*
+ * Time until the earliest enabled libdbus timeout expires; a caller's
+ * poll() must not sleep past it for pending replies to time out.
+ *
+ * Returns ms (0 if already due), -1 if no timeout is armed.
+ */
+int bus_timeout_ms(const Bus *b);
+
+/*
+ * Set of fds to poll: one entry per fd with at least one enabled
+ * watch, events OR'd. It is kept in sync from the libdbus watch
+ * callbacks, so it only changes when libdbus adds, removes or toggles
+ * a watch and can be handed to an external event loop as is.
+ *
+ * Returns the number of entries.
+ */
+size_t bus_pollfds(const Bus *b, const struct pollfd **pfds);
+
+/*
+ * Feed poll() results back into libdbus, fire expired timeouts and
+ * move pending data.
+ * pfds/n is a copy of bus_pollfds() with revents filled in (watch
+ * callbacks may change the live set meanwhile); n may be 0 on timeout.
+ *
+ * Returns 0 on success, -1 if the connection is lost.
+ */
+int bus_handle(Bus *b, const struct pollfd *pfds, size_t n);
+
+/*
+ * Add a match rule without waiting for the bus: the reply is handled
+ * from the main loop and a failure logged as "<what> failed: <error>".
+ * Signals the rule lets through arrive once the bus has processed it.
+ *
+ * Returns 0 if the call was queued, -1 on failure.
+ */
+int bus_add_match(DBusConnection *conn, const char *rule, const char *what);
+
+#endif /* XCOFFEEBREAK_BUS_H */
@@ -0,0 +1,206 @@
+/* See LICENSE file for copyright and license details. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "camera.h"
+#include "state.h"
+#include "utils.h"
+
+#define CAMERA_PREFIX   "video"
+#define CAMERA_DEV_MASK (IN_OPEN | IN_CLOSE_WRITE | IN_CLOSE_NOWRITE | IN_DELETE_SELF)
+
+typedef struct {
+	int wd;                  /* -1 = free slot */
+	unsigned int opens;      /* IN_OPEN minus IN_CLOSE_*, floored at 0 */
+	char name[NAME_MAX + 1];
+} Device;
+
+struct Camera {
+	char *dir;
+	bool verbose;
+	int fd;                  /* inotify */
+	int dir_wd;              /* dir itself: devices appearing */
+	unsigned int busy;       /* devices with opens > 0 */
+	Device devs[CAMERA_MAX_DEVICES];
+};
+
+static bool
+is_camera(const char *name)
+{
+	return strncmp(name, CAMERA_PREFIX, sizeof(CAMERA_PREFIX) - 1) == 0;
+}
+
+static Device *
+device_by_wd(Camera *c, int wd)
+{
+	for (int i = 0; i < CAMERA_MAX_DEVICES; i++)
+		if (c->devs[i].wd == wd)
+			return &c->devs[i];
+	return NULL;
+}
+
+static void
+device_add(Camera *c, const char *name)
+{
+	char path[PATH_MAX];
+	Device *d;
+	int wd;
+
+	if (snprintf(path, sizeof(path), "%s/%s", c->dir, name) >= (int)sizeof(path))
+		return;
+
+	/* Same inode watched twice yields the same wd */
+	if ((wd = inotify_add_watch(c->fd, path, CAMERA_DEV_MASK)) < 0 || device_by_wd(c, wd))
+		return;
+
+	if (!(d = device_by_wd(c, -1))) {
+		inotify_rm_watch(c->fd, wd);
+		warn("[CAMERA] more than %d devices, ignoring %s", CAMERA_MAX_DEVICES, name);
+		return;
+	}
+
+	d->wd = wd;
+	d->opens = 0;
+	snprintf(d->name, sizeof(d->name), "%s", name);
+	verbose(c->verbose, "[CAMERA] watching %s", path);
+}
+
+static void
+device_set_opens(Camera *c, Device *d, unsigned int opens)
+{
+	if ((d->opens > 0) == (opens > 0)) {
+		d->opens = opens;
+		return;
+	}
+
+	d->opens = opens;
+	if (opens)
+		c->busy++;
+	else if (c->busy > 0)
+		c->busy--;
+
+	verbose(c->verbose, "[CAMERA] %s %s", d->name, opens ? "in use" : "released");
+}
+
+static void
+device_remove(Camera *c, Device *d)
+{
+	device_set_opens(c, d, 0);
+	d->wd = -1;
+}
+
+/* ------------------------------ camera public ---------------------------- */
+
+Camera *
+camera_init(const char *dir, bool v)
+{
+	struct dirent *de;
+	Camera *c;
+	DIR *dp;
+
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		warn("[CAMERA] calloc failed, running without camera inhibit");
+		return NULL;
+	}
+
+	for (int i = 0; i < CAMERA_MAX_DEVICES; i++)
+		c->devs[i].wd = -1;
+	c->verbose = v;
+
+	if (!(c->dir = strdup(dir)) ||
+	    (c->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+		free(c->dir);
+		free(c);
+		warn("[CAMERA] inotify_init1:");
+		return NULL;
+	}
+
+	/* Watch the directory first so no device slips in between */
+	if ((c->dir_wd = inotify_add_watch(c->fd, dir, IN_CREATE | IN_MOVED_TO)) < 0) {
+		warn("[CAMERA] inotify_add_watch %s:", dir);
+		camera_cleanup(c);
+		return NULL;
+	}
+
+	if ((dp = opendir(dir))) {
+		while ((de = readdir(dp)))
+			if (is_camera(de->d_name))
+				device_add(c, de->d_name);
+		closedir(dp);
+	}
+
+	return c;
+}
+
+void
+camera_cleanup(Camera *c)
+{
+	if (!c)
+		return;
+
+	/* Closing the inotify fd drops every watch */
+	if (c->fd >= 0)
+		close(c->fd);
+	free(c->dir);
+	free(c);
+}
+
+int
+camera_fd(const Camera *c)
+{
+	return c ? c->fd : -1;
+}
+
+void
+camera_dispatch(Camera *c)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t n;
+
+	if (!c)
+		return;
+
+	while ((n = read(c->fd, buf, sizeof(buf))) > 0) {
+		for (char *p = buf; p < buf + n; ) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+			Device *d;
+
+			p += sizeof(*ev) + ev->len;
+
+			if (ev->wd == c->dir_wd) {
+				if (ev->len && is_camera(ev->name))
+					device_add(c, ev->name);
+				continue;
+			}
+
+			if (!(d = device_by_wd(c, ev->wd)))
+				continue;
+
+			if (ev->mask & (IN_DELETE_SELF | IN_IGNORED))
+				device_remove(c, d);
+			else if (ev->mask & IN_OPEN)
+				device_set_opens(c, d, d->opens + 1);
+			else if (ev->mask & (IN_CLOSE_WRITE | IN_CLOSE_NOWRITE))
+				device_set_opens(c, d, d->opens ? d->opens - 1 : 0);
+		}
+	}
+
+	if (n < 0 && errno != EAGAIN && errno != EINTR)
+		warn("[CAMERA] read:");
+}
+
+unsigned int
+camera_inhibit_mask(const Camera *c)
+{
+	return c && c->busy ? INHIBIT_ALL : 0;
+}
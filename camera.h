@@ -0,0 +1,37 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef XCOFFEEBREAK_CAMERA_H
+#define XCOFFEEBREAK_CAMERA_H
+
+#include <stdbool.h>
+
+#define CAMERA_DIR "/dev"
+
+/* Upper bound of video devices tracked at once */
+#define CAMERA_MAX_DEVICES 16
+
+typedef struct Camera Camera;
+
+/*
+ * Watch dir (normally CAMERA_DIR) for video* devices and count their
+ * opens with inotify. Devices opened before this call are not seen
+ * until they are closed and opened again.
+ *
+ * Returns an initialized structure on success,
+ * NULL on failiure.
+ */
+Camera *camera_init(const char *dir, bool verbose);
+
+/* Remove watches and free (safe to call with NULL). */
+void camera_cleanup(Camera *c);
+
+/* The inotify fd to poll for POLLIN, -1 for NULL. */
+int camera_fd(const Camera *c);
+
+/* Drain pending inotify events; call when camera_fd() is readable. */
+void camera_dispatch(Camera *c);
+
+/* INHIBIT_ALL while any tracked device is open, 0 otherwise. */
+unsigned int camera_inhibit_mask(const Camera *c);
+
+#endif /* XCOFFEEBREAK_CAMERA_H */
@@ -0,0 +1,435 @@
+/* See LICENSE file for copyright and license details. */
+
+#define _GNU_SOURCE  /* accept4 */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ctl.h"
+#include "utils.h"
+
+#define CTL_LINE_MAX 128   /* request line, longer ones drop the client */
+#define CTL_REPLY_MAX 256
+
+typedef struct {
+	char buf[CTL_LINE_MAX];
+	size_t len;
+	bool subscribed;
+} Client;
+
+struct Ctl {
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	bool verbose;
+
+	/* pfds[0] is the listener, pfds[1..nclients] match clients[] */
+	struct pollfd pfds[1 + CTL_MAX_CLIENTS];
+	Client clients[CTL_MAX_CLIENTS];
+	size_t nclients;
+
+	unsigned int events;
+	unsigned long long paused_until_ms;  /* 0 = not paused */
+
+	/* Snapshot from ctl_publish() */
+	State state;
+	unsigned long idle_ms;
+	State next;
+	long next_ms;
+	unsigned int inhibit;
+	unsigned long long snap_ms;
+	bool snap_paused;
+	bool have_snap;
+};
+
+/* ------------------------------ clients ---------------------------------- */
+
+static void
+client_drop(Ctl *c, size_t i)
+{
+	close(c->pfds[1 + i].fd);
+
+	/* Keep the arrays dense: move the last client into the hole */
+	c->nclients--;
+	if (i != c->nclients) {
+		c->pfds[1 + i] = c->pfds[1 + c->nclients];
+		c->clients[i] = c->clients[c->nclients];
+	}
+}
+
+/* Best effort, replies are small; a client that can't take one is dropped. */
+static bool
+client_send(Ctl *c, size_t i, const char *line, size_t len)
+{
+	ssize_t n = send(c->pfds[1 + i].fd, line, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+	if (n == (ssize_t)len)
+		return true;
+
+	verbose(c->verbose, "[CTL] dropping client that stopped reading");
+	client_drop(c, i);
+	return false;
+}
+
+static unsigned long
+paused_left_ms(const Ctl *c, unsigned long long now_ms)
+{
+	return c->paused_until_ms > now_ms ? (unsigned long)(c->paused_until_ms - now_ms) : 0;
+}
+
+static size_t
+format_status(const Ctl *c, char *buf, size_t size)
+{
+	unsigned long long now_ms = monotonic_ms();
+	unsigned long since = 0, idle_ms;
+	long next_ms = c->next_ms;
+	int n;
+
+	if (!c->have_snap)
+		return (size_t)snprintf(buf, size, "state=UNKNOWN\n");
+
+	/* Idle keeps growing between samples unless inhibited */
+	if (now_ms > c->snap_ms)
+		since = (unsigned long)(now_ms - c->snap_ms);
+	idle_ms = c->idle_ms + (c->inhibit ? 0 : since);
+	if (next_ms > 0 && !c->inhibit)
+		next_ms = next_ms > (long)since ? next_ms - (long)since : 0;
+
+	n = snprintf(buf, size, "state=%s idle_ms=%lu next=%s next_ms=%ld inhibit=0x%x paused_ms=%lu\n",
+	             state_name(c->state), idle_ms,
+	             c->next_ms >= 0 ? state_name(c->next) : "none", next_ms,
+	             c->inhibit, paused_left_ms(c, now_ms));
+
+	return n < 0 ? 0 : ((size_t)n >= size ? size - 1 : (size_t)n);
+}
+
+static void
+notify_subscribers(Ctl *c)
+{
+	char line[CTL_REPLY_MAX];
+	size_t len = format_status(c, line, sizeof(line));
+
+	for (size_t i = c->nclients; i-- > 0; )
+		if (c->clients[i].subscribed)
+			(void)client_send(c, i, line, len);
+}
+
+/* Returns false if the client was dropped. */
+static bool
+handle_request(Ctl *c, size_t i, char *req)
+{
+	char reply[CTL_REPLY_MAX];
+	unsigned long secs;
+	char *end;
+
+	verbose(c->verbose, "[CTL] request: %s", req);
+
+	if (streq(req, "status")) {
+		return client_send(c, i, reply, format_status(c, reply, sizeof(reply)));
+	} else if (streq(req, "lock")) {
+		c->events |= CTL_EV_LOCK;
+	} else if (strncmp(req, "pause ", 6) == 0) {
+		errno = 0;
+		secs = strtoul(req + 6, &end, 10);
+		if (errno || end == req + 6 || *end || !secs || secs > CTL_PAUSE_MAX_S)
+			return client_send(c, i, "error bad duration\n", 19);
+		c->paused_until_ms = monotonic_ms() + secs * 1000ULL;
+	} else if (streq(req, "resume")) {
+		c->paused_until_ms = 0;
+	} else if (streq(req, "subscribe")) {
+		c->clients[i].subscribed = true;
+	} else {
+		return client_send(c, i, "error unknown command\n", 22);
+	}
+
+	return client_send(c, i, "ok\n", 3);
+}
+
+/* Read what is there and handle complete lines. */
+static void
+client_read(Ctl *c, size_t i)
+{
+	Client *cl = &c->clients[i];
+	ssize_t n;
+
+	n = recv(c->pfds[1 + i].fd, cl->buf + cl->len, sizeof(cl->buf) - cl->len, MSG_DONTWAIT);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+		client_drop(c, i);
+		return;
+	}
+	if (n < 0)
+		return;
+
+	cl->len += (size_t)n;
+
+	for (;;) {
+		char *nl = memchr(cl->buf, '\n', cl->len);
+		size_t used;
+
+		if (!nl) {
+			if (cl->len == sizeof(cl->buf))
+				client_drop(c, i);
+			return;
+		}
+
+		*nl = '\0';
+		if (nl > cl->buf && nl[-1] == '\r')
+			nl[-1] = '\0';
+
+		if (!handle_request(c, i, cl->buf))
+			return;
+
+		used = (size_t)(nl - cl->buf) + 1;
+		memmove(cl->buf, nl + 1, cl->len - used);
+		cl->len -= used;
+	}
+}
+
+static void
+accept_clients(Ctl *c)
+{
+	int fd;
+
+	while ((fd = accept4(c->pfds[0].fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		if (c->nclients == CTL_MAX_CLIENTS) {
+			warn("[CTL] too many clients");
+			close(fd);
+			continue;
+		}
+
+		c->pfds[1 + c->nclients] = (struct pollfd){ fd, POLLIN, 0 };
+		memset(&c->clients[c->nclients], 0, sizeof(c->clients[0]));
+		c->nclients++;
+	}
+}
+
+/* ------------------------------ socket setup ----------------------------- */
+
+/* Returns true if something answers on path (another instance). */
+static bool
+socket_alive(const struct sockaddr_un *addr)
+{
+	int fd, ret;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		return false;
+
+	ret = connect(fd, (const struct sockaddr *)addr, sizeof(*addr));
+	close(fd);
+	return ret == 0;
+}
+
+static int
+ctl_path(char *buf, size_t size)
+{
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+
+	if (!dir || !*dir)
+		return -1;
+
+	return snprintf(buf, size, "%s/" CTL_SOCKET, dir) < (int)size ? 0 : -1;
+}
+
+/* ------------------------------- ctl public ------------------------------ */
+
+Ctl *
+ctl_init(bool v)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	Ctl *c;
+	int fd, ret;
+
+	if (ctl_path(addr.sun_path, sizeof(addr.sun_path)) < 0) {
+		warn("[CTL] XDG_RUNTIME_DIR not usable, control socket disabled");
+		return NULL;
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+		warn("[CTL] socket:");
+		return NULL;
+	}
+
+	ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	if (ret < 0 && errno == EADDRINUSE) {
+		if (socket_alive(&addr)) {
+			warn("[CTL] %s in use by another instance", addr.sun_path);
+			close(fd);
+			return NULL;
+		}
+		unlink(addr.sun_path);
+		ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	}
+
+	/* Runtime dir is 0700 already; be explicit anyway */
+	if (ret < 0 || chmod(addr.sun_path, 0600) < 0 || listen(fd, CTL_MAX_CLIENTS) < 0) {
+		warn("[CTL] %s:", addr.sun_path);
+		close(fd);
+		return NULL;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		warn("[CTL] calloc failed");
+		unlink(addr.sun_path);
+		close(fd);
+		return NULL;
+	}
+
+	memcpy(c->path, addr.sun_path, sizeof(c->path));
+	c->verbose = v;
+	c->pfds[0] = (struct pollfd){ fd, POLLIN, 0 };
+
+	verbose(v, "[CTL] listening on %s", c->path);
+	return c;
+}
+
+void
+ctl_cleanup(Ctl *c)
+{
+	if (!c)
+		return;
+
+	while (c->nclients)
+		client_drop(c, c->nclients - 1);
+
+	close(c->pfds[0].fd);
+	unlink(c->path);
+	free(c);
+}
+
+size_t
+ctl_pollfds(const Ctl *c, const struct pollfd **pfds)
+{
+	if (!c) {
+		*pfds = NULL;
+		return 0;
+	}
+
+	*pfds = c->pfds;
+	return 1 + c->nclients;
+}
+
+void
+ctl_dispatch(Ctl *c, const struct pollfd *pfds, size_t n)
+{
+	if (!c || !n)
+		return;
+
+	/* Match by fd: our own array shifts as clients go away */
+	for (size_t k = 1; k < n; k++) {
+		if (!pfds[k].revents)
+			continue;
+
+		for (size_t i = 0; i < c->nclients; i++) {
+			if (c->pfds[1 + i].fd != pfds[k].fd)
+				continue;
+
+			if (pfds[k].revents & (POLLIN | POLLHUP | POLLERR))
+				client_read(c, i);
+			break;
+		}
+	}
+
+	if (pfds[0].revents & POLLIN)
+		accept_clients(c);
+}
+
+unsigned int
+ctl_events(Ctl *c)
+{
+	unsigned int ev;
+
+	if (!c)
+		return 0;
+
+	ev = c->events;
+	c->events = 0;
+	return ev;
+}
+
+unsigned int
+ctl_inhibit_mask(Ctl *c)
+{
+	if (!c || !c->paused_until_ms)
+		return 0;
+
+	if (monotonic_ms() >= c->paused_until_ms) {
+		c->paused_until_ms = 0;
+		verbose(c->verbose, "[CTL] pause ended");
+		return 0;
+	}
+
+	return INHIBIT_ALL;
+}
+
+void
+ctl_publish(Ctl *c, const StateManager *sm, const Options *opt)
+{
+	bool changed, paused;
+
+	if (!c)
+		return;
+
+	paused = c->paused_until_ms != 0;
+	changed = !c->have_snap || c->state != sm->current || c->snap_paused != paused;
+
+	c->state = sm->current;
+	c->idle_ms = state_manager_idle_ms(sm);
+	c->inhibit = sm->last_inhibit;
+	c->next = sm->current < ST_SUSPENDED ? (State)(sm->current + 1) : ST_SUSPENDED;
+	c->next_ms = state_manager_ms_until(sm, opt, c->next);
+	c->snap_ms = monotonic_ms();
+	c->snap_paused = paused;
+	c->have_snap = true;
+
+	if (changed)
+		notify_subscribers(c);
+}
+
+int
+ctl_client(const char *cmd)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char buf[CTL_REPLY_MAX];
+	bool subscribe = streq(cmd, "subscribe");
+	size_t len = strlen(cmd);
+	ssize_t n;
+	int fd, ret = 1;
+
+	if (ctl_path(addr.sun_path, sizeof(addr.sun_path)) < 0) {
+		warn("XDG_RUNTIME_DIR is not set");
+		return 1;
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+	    connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		warn("%s:", addr.sun_path);
+		if (fd >= 0)
+			close(fd);
+		return 1;
+	}
+
+	if (send(fd, cmd, len, MSG_NOSIGNAL) != (ssize_t)len || send(fd, "\n", 1, MSG_NOSIGNAL) != 1) {
+		warn("send:");
+		close(fd);
+		return 1;
+	}
+
+	/* One reply line, or a stream of them when subscribed */
+	while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+		fwrite(buf, 1, (size_t)n, stdout);
+		fflush(stdout);
+		if (!subscribe && memchr(buf, '\n', (size_t)n)) {
+			ret = strncmp(buf, "error", 5) == 0;
+			break;
+		}
+		ret = 0;
+	}
+
+	close(fd);
+	return ret;
+}
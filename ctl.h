@@ -0,0 +1,72 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef XCOFFEEBREAK_CTL_H
+#define XCOFFEEBREAK_CTL_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "args.h"
+#include "state.h"
+
+#define CTL_SOCKET      "xcoffeebreak.sock"  /* in $XDG_RUNTIME_DIR */
+#define CTL_MAX_CLIENTS 8
+#define CTL_PAUSE_MAX_S 86400  /* longest pause, one day */
+
+/* Events reported by ctl_events() */
+enum {
+	CTL_EV_LOCK = 1 << 0,    /* "lock" received */
+};
+
+typedef struct Ctl Ctl;
+
+/*
+ * Listen on $XDG_RUNTIME_DIR/CTL_SOCKET. A stale socket is replaced,
+ * a live one (another instance) makes this fail.
+ *
+ * Line protocol, one request per line, one reply line each:
+ *   status            state=LOCKED idle_ms=.. next=OFF next_ms=.. ...
+ *   lock              lock now (deduped like any other lock)
+ *   pause <seconds>   block every stage for that long, 1..CTL_PAUSE_MAX_S
+ *   resume            end a pause
+ *   subscribe         push a status line on every state/pause change
+ *
+ * Returns an initialized structure on success,
+ * NULL on failiure.
+ */
+Ctl *ctl_init(bool verbose);
+
+/* Close clients, remove the socket and free (safe to call with NULL). */
+void ctl_cleanup(Ctl *c);
+
+/* Fds to poll (listener + clients), see mpris_pollfds(). */
+size_t ctl_pollfds(const Ctl *c, const struct pollfd **pfds);
+
+/*
+ * Hand back the entries from ctl_pollfds() with revents filled in;
+ * accepts clients and answers their requests from the last snapshot.
+ */
+void ctl_dispatch(Ctl *c, const struct pollfd *pfds, size_t n);
+
+/* Collect and clear the CTL_EV_* bits seen since the last call. */
+unsigned int ctl_events(Ctl *c);
+
+/* INHIBIT_ALL while a pause is running, 0 otherwise. */
+unsigned int ctl_inhibit_mask(Ctl *c);
+
+/*
+ * Snapshot the state for status requests and notify subscribers if the
+ * state changed. Cheap, call once per iteration.
+ */
+void ctl_publish(Ctl *c, const StateManager *sm, const Options *opt);
+
+/*
+ * Client side of --ctl: send cmd to the running daemon and print the
+ * replies (all pushed lines for "subscribe").
+ *
+ * Returns 0 on success, 1 on failure.
+ */
+int ctl_client(const char *cmd);
+
+#endif /* XCOFFEEBREAK_CTL_H */
@@ -0,0 +1,289 @@
+/* See LICENSE file for copyright and license details. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "utils.h"
+
+#define LOG_RATE_SLOTS 32   /* call sites tracked at once */
+#define LOG_RATE_PROBE 4    /* slots a call site may take, from its hash on */
+#define LOG_IOV_MAX    32   /* 6 fields, 5 iovecs each at most */
+
+typedef struct {
+	const char *fmt;      /* call site, NULL = free */
+	time_t window;        /* start of the current interval */
+	unsigned int n;       /* messages in it */
+	unsigned int dropped; /* not emitted since the last one that was */
+} RateSlot;
+
+typedef struct {
+	struct iovec iov[LOG_IOV_MAX];
+	unsigned char len[LOG_IOV_MAX / 5][8];  /* binary field sizes */
+	size_t n, nlen;
+} Dgram;
+
+static const char *const level_tag[] = {
+	[LOG_FATAL]   = "xcoffeebreak: [FATAL] ",
+	[LOG_WARN]    = "xcoffeebreak: [WARN] ",
+	[LOG_VERBOSE] = "xcoffeebreak: [VERBOSE] ",
+};
+
+static const char *const level_priority[] = {
+	[LOG_FATAL]   = "2",  /* LOG_CRIT */
+	[LOG_WARN]    = "4",  /* LOG_WARNING */
+	[LOG_VERBOSE] = "6",  /* LOG_INFO */
+};
+
+static RateSlot g_rate[LOG_RATE_SLOTS + 1];  /* the last one is shared overflow */
+static int g_journal_fd = -1;
+static time_t g_ts_sec = (time_t)-1;  /* second g_ts was formatted for */
+static char g_ts[64];                 /* "[YYYY-mm-dd HH:MM:SS] " */
+
+/* ----------------------------- rate limiting ----------------------------- */
+
+/*
+ * The call site's slot, found by linear probing from the hash of fmt.
+ * A site without one takes a free or expired slot on the way; if every
+ * probed slot is busy, it shares the overflow slot with other such
+ * sites instead of stealing one from a site being limited.
+ */
+static RateSlot *
+rate_slot(const char *fmt, time_t now)
+{
+	size_t h = ((uintptr_t)fmt >> 3) % LOG_RATE_SLOTS;
+	RateSlot *spare = NULL;
+
+	for (size_t i = 0; i < LOG_RATE_PROBE; i++) {
+		RateSlot *s = &g_rate[(h + i) % LOG_RATE_SLOTS];
+
+		if (s->fmt == fmt)
+			return s;
+		if (!spare && (!s->fmt || now - s->window >= LOG_INTERVAL_S))
+			spare = s;
+	}
+
+	if (!spare)
+		return &g_rate[LOG_RATE_SLOTS];
+
+	*spare = (RateSlot){ .fmt = fmt, .window = now };
+	return spare;
+}
+
+/*
+ * Returns false if the message should be dropped; otherwise *dropped
+ * is how many were since the last one from this call site (or from the
+ * sites sharing the overflow slot).
+ */
+static bool
+rate_pass(const char *fmt, time_t now, unsigned int *dropped)
+{
+	RateSlot *s = rate_slot(fmt, now);
+
+	*dropped = 0;
+
+	if (now - s->window >= LOG_INTERVAL_S) {
+		*dropped = s->dropped;
+		s->window = now;
+		s->n = 0;
+		s->dropped = 0;
+	}
+
+	if (s->n >= LOG_BURST) {
+		s->dropped++;
+		return false;
+	}
+
+	s->n++;
+	return true;
+}
+
+/* ------------------------------- formatting ------------------------------ */
+
+/* Reformatted once a second at most */
+static const char *
+timestamp(time_t now)
+{
+	struct tm tm;
+
+	if (now != g_ts_sec && now != (time_t)-1 && localtime_r(&now, &tm)) {
+		snprintf(g_ts, sizeof(g_ts), "[%04d-%02d-%02d %02d:%02d:%02d] ",
+		         tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+		         tm.tm_hour, tm.tm_min, tm.tm_sec);
+		g_ts_sec = now;
+	}
+
+	return g_ts;
+}
+
+static size_t
+append(char *buf, size_t len, size_t cap, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (len >= cap)
+		return len;
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf + len, cap - len, fmt, ap);
+	va_end(ap);
+
+	if (n > 0)
+		len += (size_t)n;
+	return len < cap ? len : cap - 1;
+}
+
+/* -------------------------------- journal -------------------------------- */
+
+static void
+dgram_add(Dgram *d, const void *p, size_t len)
+{
+	d->iov[d->n].iov_base = (void *)p;
+	d->iov[d->n].iov_len = len;
+	d->n++;
+}
+
+/* KEY=value\n, or the binary form if value holds a newline */
+static void
+dgram_field(Dgram *d, const char *key, const char *val, size_t len)
+{
+	unsigned char *le;
+
+	dgram_add(d, key, strlen(key));
+
+	if (!memchr(val, '\n', len)) {
+		dgram_add(d, "=", 1);
+	} else {
+		le = d->len[d->nlen++];
+		for (int i = 0; i < 8; i++)
+			le[i] = (unsigned char)((unsigned long long)len >> (8 * i));
+		dgram_add(d, "\n", 1);
+		dgram_add(d, le, 8);
+	}
+
+	dgram_add(d, val, len);
+	dgram_add(d, "\n", 1);
+}
+
+static int
+journal_send(LogLevel lvl, const LogFields *f, const char *msg, size_t len)
+{
+	struct msghdr mh = {0};
+	char idle[24];
+	Dgram d;
+
+	d.n = d.nlen = 0;
+
+	dgram_field(&d, "MESSAGE", msg, len);
+	dgram_field(&d, "PRIORITY", level_priority[lvl], 1);
+	dgram_field(&d, "SYSLOG_IDENTIFIER", "xcoffeebreak", 12);
+
+	if (f && f->state)
+		dgram_field(&d, "STATE", f->state, strlen(f->state));
+	if (f && f->player)
+		dgram_field(&d, "PLAYER", f->player, strlen(f->player));
+	if (f && f->idle_ms >= 0) {
+		int n = snprintf(idle, sizeof(idle), "%ld", f->idle_ms);
+
+		dgram_field(&d, "IDLE_MS", idle, (size_t)n);
+	}
+
+	mh.msg_iov = d.iov;
+	mh.msg_iovlen = d.n;
+
+	/* A backed up journal must not stall the loop */
+	return sendmsg(g_journal_fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL) < 0 ? -1 : 0;
+}
+
+/* ------------------------------ log public ------------------------------- */
+
+int
+log_journal_open(bool v)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	int fd;
+
+	log_close();
+
+	memcpy(sa.sun_path, LOG_JOURNAL_SOCKET, sizeof(LOG_JOURNAL_SOCKET));
+
+	if ((fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0) {
+		warn("[LOG] socket:");
+		return -1;
+	}
+
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		warn("[LOG] %s:", LOG_JOURNAL_SOCKET);
+		close(fd);
+		return -1;
+	}
+
+	g_journal_fd = fd;
+	verbose(v, "[LOG] logging to the journal");
+	return 0;
+}
+
+void
+log_close(void)
+{
+	if (g_journal_fd >= 0)
+		close(g_journal_fd);
+	g_journal_fd = -1;
+}
+
+void
+log_vwrite(LogLevel lvl, const LogFields *f, int errnum, const char *fmt, va_list ap)
+{
+	char line[LOG_LINE_MAX];
+	unsigned int dropped = 0;
+	time_t now = time(NULL);
+	size_t len, body;
+	int n;
+
+	if (lvl != LOG_FATAL && !rate_pass(fmt, now, &dropped))
+		return;
+
+	len = append(line, 0, sizeof(line), "%s%s", level_tag[lvl],
+	             lvl == LOG_VERBOSE ? timestamp(now) : "");
+	body = len;
+
+	n = vsnprintf(line + len, sizeof(line) - len, fmt, ap);
+	if (n > 0)
+		len += (size_t)n;
+	if (len >= sizeof(line))
+		len = sizeof(line) - 1;
+
+	if (errnum >= 0 && fmt[0] && fmt[strlen(fmt) - 1] == ':')
+		len = append(line, len, sizeof(line), " %s", strerror(errnum));
+	if (dropped)
+		len = append(line, len, sizeof(line), " (%u similar suppressed)", dropped);
+
+	if (g_journal_fd >= 0 && journal_send(lvl, f, line + body, len - body) == 0)
+		return;
+
+	line[len++] = '\n';  /* len < sizeof(line) */
+	if (write(STDERR_FILENO, line, len) < 0)
+		return;  /* nowhere left to report it */
+}
+
+void
+log_fields(bool v, const LogFields *f, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!v)
+		return;
+
+	va_start(ap, fmt);
+	log_vwrite(LOG_VERBOSE, f, -1, fmt, ap);
+	va_end(ap);
+}
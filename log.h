@@ -0,0 +1,50 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef XCOFFEEBREAK_LOG_H
+#define XCOFFEEBREAK_LOG_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+
+#define LOG_LINE_MAX    512   /* one message, longer ones are cut */
+#define LOG_BURST       10    /* messages per call site and interval */
+#define LOG_INTERVAL_S  5     /* rate limit window */
+#define LOG_JOURNAL_SOCKET "/run/systemd/journal/socket"
+
+typedef enum {
+	LOG_FATAL = 0,
+	LOG_WARN,
+	LOG_VERBOSE,
+} LogLevel;
+
+/* Structured journal fields, all optional. */
+typedef struct {
+	const char *state;    /* STATE= */
+	const char *player;   /* PLAYER= */
+	long idle_ms;         /* IDLE_MS=, < 0: none */
+} LogFields;
+
+/*
+ * Send messages to the journal's native socket, with fields, instead
+ * of stderr. A message the journal does not take still goes to stderr.
+ *
+ * Returns 0 on success, -1 on failiure.
+ */
+int log_journal_open(bool verbose);
+
+/* Back to stderr only. */
+void log_close(void);
+
+/*
+ * Format and emit one message with a single write() (or sendmsg()).
+ * A trailing ':' in fmt appends strerror(errnum). Warnings and verbose
+ * messages are rate limited per fmt: past LOG_BURST in LOG_INTERVAL_S
+ * they are dropped and counted, the count is logged with the next one
+ * that gets through. f may be NULL.
+ */
+void log_vwrite(LogLevel lvl, const LogFields *f, int errnum, const char *fmt, va_list ap);
+
+/* verbose() with journal fields. */
+void log_fields(bool v, const LogFields *f, const char *fmt, ...);
+
+#endif /* XCOFFEEBREAK_LOG_H */
@@ -0,0 +1,616 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <dbus/dbus.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "bus.h"
+#include "logind.h"
+#include "utils.h"
+
+#define LOGIND_NAME           "org.freedesktop.login1"
+#define LOGIND_PATH           "/org/freedesktop/login1"
+#define LOGIND_MANAGER_IFACE  "org.freedesktop.login1.Manager"
+#define LOGIND_SESSION_IFACE  "org.freedesktop.login1.Session"
+#define LOGIND_CALL_TIMEOUT_MS 1000  /* setup calls, answered from the main loop (ms) */
+#define LOGIND_SESSION_MAX     128   /* session object path, e.g. .../session/_32 */
+#define LOGIND_OWNER_MAX       (DBUS_MAXIMUM_NAME_LENGTH + 1)
+#define LOGIND_RECONNECT_MIN_MS 1000   /* first retry after losing the bus */
+#define LOGIND_RECONNECT_MAX_MS 60000  /* retry backoff ceiling */
+
+#define LOGIND_SLEEP_MATCH \
+	"type='signal',sender='" LOGIND_NAME "',path='" LOGIND_PATH "'," \
+	"interface='" LOGIND_MANAGER_IFACE "',member='PrepareForSleep'"
+
+/* logind's unique name changing hands, see owner_set() */
+#define LOGIND_OWNER_MATCH \
+	"type='signal',sender='" DBUS_SERVICE_DBUS "',interface='" DBUS_INTERFACE_DBUS "'," \
+	"member='NameOwnerChanged',arg0='" LOGIND_NAME "'"
+
+/* Lock and Unlock on our session object; the path is appended at runtime */
+#define LOGIND_LOCK_MATCH_FMT \
+	"type='signal',sender='" LOGIND_NAME "',interface='" LOGIND_SESSION_IFACE "',path='%s'"
+
+struct Logind {
+	Bus *bus;
+	DBusConnection *conn;    /* bus_conn(bus) */
+	char session[LOGIND_SESSION_MAX]; /* session object path, "" until resolved */
+	char owner[LOGIND_OWNER_MAX];     /* logind's unique name, "" until known */
+	bool verbose;
+	bool dry_run;
+
+	bool idle_hint;          /* last value asked for, sent once the session is known */
+	bool sleeping;           /* between PrepareForSleep(true) and (false) */
+	int sleep_fd;            /* delay inhibitor, -1 when not held */
+	unsigned int events;     /* LOGIND_EV_* not yet collected */
+
+	/* Setup calls in flight; init never waits for logind */
+	DBusPendingCall *session_pending; /* GetSession or GetSessionByPID */
+	bool session_by_pid;
+	DBusPendingCall *inhibit_pending; /* Inhibit(sleep, delay) */
+
+	/* System bus lost: next attempt, see logind_try_reconnect() */
+	unsigned long long lost_at_ms;  /* 0 while connected */
+	unsigned long long retry_at_ms;
+	unsigned long retry_backoff_ms;
+};
+
+/* --------------------------- logind DBus helpers ------------------------- */
+
+/*
+ * Send msg (consumed) to the Manager with fn handling the reply from
+ * the main loop.
+ * Returns the pending call, NULL on failiure.
+ */
+static DBusPendingCall *
+manager_call(Logind *l, DBusMessage *msg, DBusPendingCallNotifyFunction fn)
+{
+	DBusPendingCall *pc = NULL;
+
+	if (!dbus_connection_send_with_reply(l->conn, msg, &pc, LOGIND_CALL_TIMEOUT_MS) || !pc) {
+		dbus_message_unref(msg);
+		return NULL;
+	}
+	dbus_message_unref(msg);
+
+	if (!dbus_pending_call_set_notify(pc, fn, l, NULL)) {
+		dbus_pending_call_cancel(pc);
+		dbus_pending_call_unref(pc);
+		return NULL;
+	}
+
+	return pc;
+}
+
+static void session_notify(DBusPendingCall *pc, void *data);
+
+/* Prefer XDG_SESSION_ID (set by pam_systemd), fall back to our PID. */
+static int
+session_request(Logind *l, bool by_pid)
+{
+	const char *id = getenv("XDG_SESSION_ID");
+	dbus_uint32_t pid = (dbus_uint32_t)getpid();
+	DBusMessage *msg;
+	bool ok;
+
+	if (!id || !*id)
+		by_pid = true;
+
+	msg = dbus_message_new_method_call(LOGIND_NAME, LOGIND_PATH, LOGIND_MANAGER_IFACE,
+	                                   by_pid ? "GetSessionByPID" : "GetSession");
+	if (!msg)
+		return -1;
+
+	ok = by_pid ? dbus_message_append_args(msg, DBUS_TYPE_UINT32, &pid, DBUS_TYPE_INVALID)
+	            : dbus_message_append_args(msg, DBUS_TYPE_STRING, &id, DBUS_TYPE_INVALID);
+	if (!ok) {
+		dbus_message_unref(msg);
+		return -1;
+	}
+
+	l->session_by_pid = by_pid;
+	l->session_pending = manager_call(l, msg, session_notify);
+	return l->session_pending ? 0 : -1;
+}
+
+static void
+reply_notify(DBusPendingCall *pc, void *data)
+{
+	DBusMessage *reply;
+	const char *what = (const char *)data;
+
+	reply = dbus_pending_call_steal_reply(pc);
+	dbus_pending_call_unref(pc);
+
+	if (!reply)
+		return;
+
+	if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR)
+		warn("[LOGIND] %s failed: %s", what,
+		     dbus_message_get_error_name(reply));
+
+	dbus_message_unref(reply);
+}
+
+/*
+ * Fire-and-forget call on the session object; failures are logged from
+ * the reply, the main loop never waits for logind.
+ */
+static void
+session_call_bool(Logind *l, const char *method, bool value)
+{
+	DBusMessage *msg;
+	DBusPendingCall *pc = NULL;
+	dbus_bool_t b = value;
+
+	msg = dbus_message_new_method_call(LOGIND_NAME, l->session, LOGIND_SESSION_IFACE, method);
+	if (!msg)
+		return;
+
+	if (!dbus_message_append_args(msg, DBUS_TYPE_BOOLEAN, &b, DBUS_TYPE_INVALID) ||
+	    !dbus_connection_send_with_reply(l->conn, msg, &pc, DBUS_TIMEOUT_USE_DEFAULT) || !pc) {
+		dbus_message_unref(msg);
+		return;
+	}
+	dbus_message_unref(msg);
+
+	/* method is a string literal, fine as notify data */
+	if (!dbus_pending_call_set_notify(pc, reply_notify, (void *)method, NULL)) {
+		dbus_pending_call_cancel(pc);
+		dbus_pending_call_unref(pc);
+	}
+}
+
+static void
+logind_log_session(const Logind *l)
+{
+	verbose(l->verbose, "[LOGIND] session %s", l->session);
+}
+
+static void
+pending_drop(DBusPendingCall **pc)
+{
+	if (!*pc)
+		return;
+
+	dbus_pending_call_cancel(*pc);
+	dbus_pending_call_unref(*pc);
+	*pc = NULL;
+}
+
+/*
+ * Remember logind's unique name: signals addressed to us directly skip
+ * match rules, so only this tells logind apart from any other peer.
+ * Errors the bus daemon sends on logind's behalf don't count.
+ */
+static void
+owner_set(Logind *l, const char *owner)
+{
+	if (!owner || strlen(owner) >= sizeof(l->owner) || streq(owner, l->owner) ||
+	    streq(owner, DBUS_SERVICE_DBUS))
+		return;
+
+	strcpy(l->owner, owner);
+	verbose(l->verbose, "[LOGIND] %s owned by %s", LOGIND_NAME, *owner ? owner : "nobody");
+}
+
+static bool
+from_logind(const Logind *l, DBusMessage *msg)
+{
+	return l->owner[0] && dbus_message_has_sender(msg, l->owner);
+}
+
+/* Session known: Lock/Unlock on it, and an idle hint asked for meanwhile */
+static void
+session_resolved(Logind *l)
+{
+	char rule[512];
+
+	logind_log_session(l);
+
+	if (snprintf(rule, sizeof(rule), LOGIND_LOCK_MATCH_FMT, l->session) >= (int)sizeof(rule) ||
+	    bus_add_match(l->conn, rule, "[LOGIND] add_match(Lock)") < 0)
+		warn("[LOGIND] cannot subscribe to session signals");
+
+	if (l->idle_hint && !l->dry_run)
+		session_call_bool(l, "SetIdleHint", true);
+}
+
+static void
+session_notify(DBusPendingCall *pc, void *data)
+{
+	Logind *l = (Logind *)data;
+	DBusMessage *reply;
+	const char *path = NULL, *err;
+	const char *method = l->session_by_pid ? "GetSessionByPID" : "GetSession";
+
+	reply = dbus_pending_call_steal_reply(pc);
+	dbus_pending_call_unref(pc);
+	l->session_pending = NULL;
+
+	if (!reply)
+		return;
+
+	owner_set(l, dbus_message_get_sender(reply));
+	if (dbus_message_get_args(reply, NULL, DBUS_TYPE_OBJECT_PATH, &path, DBUS_TYPE_INVALID) &&
+	    strlen(path) < sizeof(l->session)) {
+		strcpy(l->session, path);
+		dbus_message_unref(reply);
+		session_resolved(l);
+		return;
+	}
+
+	err = dbus_message_get_error_name(reply);
+	verbose(l->verbose, "[LOGIND] %s failed: %s", method,
+	        path ? "session path too long" : err ? err : "bad reply");
+	dbus_message_unref(reply);
+
+	if (l->session_by_pid || session_request(l, true) < 0)
+		warn("[LOGIND] no logind session, idle hints and lock-session disabled");
+}
+
+static void
+inhibit_notify(DBusPendingCall *pc, void *data)
+{
+	Logind *l = (Logind *)data;
+	DBusMessage *reply;
+	const char *err;
+	int fd = -1;
+
+	reply = dbus_pending_call_steal_reply(pc);
+	dbus_pending_call_unref(pc);
+	l->inhibit_pending = NULL;
+
+	if (!reply)
+		return;
+
+	/* libdbus hands us our own dup of the fd */
+	owner_set(l, dbus_message_get_sender(reply));
+	if (!dbus_message_get_args(reply, NULL, DBUS_TYPE_UNIX_FD, &fd, DBUS_TYPE_INVALID))
+		fd = -1;
+
+	err = dbus_message_get_error_name(reply);
+	if (fd < 0)
+		warn("[LOGIND] Inhibit(sleep) failed: %s, session may wake up unlocked",
+		     err ? err : "no fd");
+	dbus_message_unref(reply);
+
+	if (fd < 0)
+		return;
+
+	/* Too late for this sleep; logind_sleep_acquire() asks again on resume */
+	if (l->sleeping) {
+		close(fd);
+		return;
+	}
+
+	l->sleep_fd = fd;
+	verbose(l->verbose, "[LOGIND] sleep delay lock taken");
+}
+
+/*
+ * Take a "delay" inhibitor on sleep: logind then waits (up to its
+ * InhibitDelayMaxSec) for us to close the fd after PrepareForSleep(true).
+ * The fd arrives in inhibit_notify().
+ */
+static int
+sleep_lock_take(Logind *l)
+{
+	DBusMessage *msg;
+	const char *what = "sleep";
+	const char *who = "xcoffeebreak";
+	const char *why = "Lock the session before sleep";
+	const char *mode = "delay";
+
+	if (l->sleep_fd >= 0 || l->inhibit_pending)
+		return 0;
+
+	msg = dbus_message_new_method_call(LOGIND_NAME, LOGIND_PATH, LOGIND_MANAGER_IFACE, "Inhibit");
+	if (!msg)
+		return -1;
+
+	if (!dbus_message_append_args(msg,
+	                              DBUS_TYPE_STRING, &what,
+	                              DBUS_TYPE_STRING, &who,
+	                              DBUS_TYPE_STRING, &why,
+	                              DBUS_TYPE_STRING, &mode,
+	                              DBUS_TYPE_INVALID)) {
+		dbus_message_unref(msg);
+		return -1;
+	}
+
+	l->inhibit_pending = manager_call(l, msg, inhibit_notify);
+	return l->inhibit_pending ? 0 : -1;
+}
+
+/*
+ * A new logind took the name: the old inhibitor died with its holder,
+ * and a session it could not find before may exist now.
+ */
+static void
+logind_restarted(Logind *l)
+{
+	verbose(l->verbose, "[LOGIND] %s restarted", LOGIND_NAME);
+
+	pending_drop(&l->inhibit_pending);
+	if (l->sleep_fd >= 0) {
+		close(l->sleep_fd);
+		l->sleep_fd = -1;
+	}
+
+	if (!l->session[0] && !l->session_pending)
+		(void)session_request(l, false);
+
+	if (!l->sleeping && sleep_lock_take(l) < 0)
+		warn("[LOGIND] cannot delay sleep, session may wake up unlocked");
+}
+
+static DBusHandlerResult
+logind_filter(DBusConnection *conn, DBusMessage *msg, void *data)
+{
+	Logind *l = (Logind *)data;
+	const char *name, *old_owner, *new_owner;
+	dbus_bool_t start;
+
+	(void)conn;
+
+	if (dbus_message_is_signal(msg, DBUS_INTERFACE_DBUS, "NameOwnerChanged") &&
+	    dbus_message_has_sender(msg, DBUS_SERVICE_DBUS) &&
+	    dbus_message_get_args(msg, NULL,
+	                          DBUS_TYPE_STRING, &name,
+	                          DBUS_TYPE_STRING, &old_owner,
+	                          DBUS_TYPE_STRING, &new_owner,
+	                          DBUS_TYPE_INVALID) &&
+	    streq(name, LOGIND_NAME)) {
+		if (*new_owner && !streq(new_owner, l->owner))
+			logind_restarted(l);
+		owner_set(l, new_owner);
+	} else if (dbus_message_is_signal(msg, LOGIND_MANAGER_IFACE, "PrepareForSleep") &&
+	    from_logind(l, msg) &&
+	    dbus_message_get_args(msg, NULL, DBUS_TYPE_BOOLEAN, &start, DBUS_TYPE_INVALID)) {
+		verbose(l->verbose, "[LOGIND] PrepareForSleep(%s)", start ? "true" : "false");
+		l->sleeping = start;
+		l->events |= start ? LOGIND_EV_SLEEP : LOGIND_EV_RESUME;
+	} else if (l->session[0] && dbus_message_has_path(msg, l->session) && from_logind(l, msg)) {
+		if (dbus_message_is_signal(msg, LOGIND_SESSION_IFACE, "Lock")) {
+			verbose(l->verbose, "[LOGIND] Lock");
+			l->events |= LOGIND_EV_LOCK;
+		} else if (dbus_message_is_signal(msg, LOGIND_SESSION_IFACE, "Unlock")) {
+			verbose(l->verbose, "[LOGIND] Unlock");
+			l->events |= LOGIND_EV_UNLOCK;
+		}
+	}
+
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+/* ---------------------------- logind connection -------------------------- */
+
+/*
+ * Hook up to the bus connection and queue the session lookup, matches
+ * and inhibitor. Nothing is waited for: the replies are handled from
+ * the main loop, which is already sampling idle time by then.
+ */
+static int
+logind_connect(Logind *l)
+{
+	if (!(l->conn = bus_conn(l->bus)))
+		return -1;
+
+	if (!dbus_connection_add_filter(l->conn, logind_filter, l, NULL)) {
+		warn("[LOGIND] add_filter failed");
+		l->conn = NULL;
+		return -1;
+	}
+
+	if (session_request(l, false) < 0) {
+		warn("[LOGIND] cannot ask for our session");
+		return -1;
+	}
+
+	if (bus_add_match(l->conn, LOGIND_OWNER_MATCH, "[LOGIND] add_match(NameOwnerChanged)") < 0)
+		warn("[LOGIND] cannot follow logind restarts");
+
+	/* Sleep handling is optional, idle hints work without it */
+	if (bus_add_match(l->conn, LOGIND_SLEEP_MATCH, "[LOGIND] add_match(PrepareForSleep)") < 0 ||
+	    sleep_lock_take(l) < 0)
+		warn("[LOGIND] cannot delay sleep, session may wake up unlocked");
+
+	return 0;
+}
+
+/* Forget everything tied to the connection; l->idle_hint is kept and resent */
+static void
+logind_disconnect(Logind *l)
+{
+	pending_drop(&l->session_pending);
+	pending_drop(&l->inhibit_pending);
+
+	if (l->sleep_fd >= 0) {
+		close(l->sleep_fd);
+		l->sleep_fd = -1;
+	}
+
+	if (l->conn)
+		dbus_connection_remove_filter(l->conn, logind_filter, l);
+	l->conn = NULL;
+
+	l->session[0] = '\0';
+	l->owner[0] = '\0';
+	l->sleeping = false;
+}
+
+/* System bus lost, reconnecting is left to logind_try_reconnect() */
+static void
+logind_lost(Logind *l)
+{
+	const unsigned long long now_ms = monotonic_ms();
+
+	warn("[LOGIND] Lost system bus, reconnecting");
+
+	logind_disconnect(l);
+
+	l->lost_at_ms = now_ms ? now_ms : 1;
+	l->retry_backoff_ms = LOGIND_RECONNECT_MIN_MS;
+	l->retry_at_ms = now_ms + l->retry_backoff_ms;
+}
+
+static void
+logind_try_reconnect(Logind *l, unsigned long long now_ms)
+{
+	if (now_ms < l->retry_at_ms)
+		return;
+
+	if (bus_reconnect(l->bus) == 0 && logind_connect(l) == 0) {
+		verbose(l->verbose, "[LOGIND] reconnected after %llu ms", now_ms - l->lost_at_ms);
+		l->lost_at_ms = 0;
+		return;
+	}
+
+	logind_disconnect(l);
+
+	l->retry_backoff_ms *= 2;
+	if (l->retry_backoff_ms > LOGIND_RECONNECT_MAX_MS)
+		l->retry_backoff_ms = LOGIND_RECONNECT_MAX_MS;
+	l->retry_at_ms = now_ms + l->retry_backoff_ms;
+}
+
+/* ------------------------------ logind public ---------------------------- */
+
+Logind *
+logind_init(bool verbose, bool dry_run)
+{
+	Logind *l;
+
+	l = calloc(1, sizeof(*l));
+	if (!l) {
+		warn("[LOGIND] calloc failed, running without logind");
+		return NULL;
+	}
+
+	l->verbose = verbose;
+	l->dry_run = dry_run;
+	l->sleep_fd = -1;
+
+	if (!(l->bus = bus_open(DBUS_BUS_SYSTEM))) {
+		free(l);
+		warn("[LOGIND] no system bus, running without logind");
+		return NULL;
+	}
+
+	if (logind_connect(l) < 0) {
+		logind_cleanup(l);
+		warn("[LOGIND] cannot talk to logind, running without it");
+		return NULL;
+	}
+
+	return l;
+}
+
+void
+logind_cleanup(Logind *l)
+{
+	if (!l)
+		return;
+
+	logind_disconnect(l);
+	bus_close(l->bus);
+	free(l);
+}
+
+int
+logind_timeout_ms(const Logind *l)
+{
+	unsigned long long now_ms;
+
+	if (!l)
+		return -1;
+
+	if (l->lost_at_ms) {
+		now_ms = monotonic_ms();
+		return l->retry_at_ms > now_ms ? (int)(l->retry_at_ms - now_ms) : 0;
+	}
+
+	return bus_timeout_ms(l->bus);
+}
+
+size_t
+logind_pollfds(const Logind *l, const struct pollfd **pfds)
+{
+	if (!l || l->lost_at_ms) {
+		*pfds = NULL;
+		return 0;
+	}
+
+	return bus_pollfds(l->bus, pfds);
+}
+
+int
+logind_dispatch(Logind *l, const struct pollfd *pfds, size_t n)
+{
+	if (!l)
+		return -1;
+
+	if (l->lost_at_ms) {
+		logind_try_reconnect(l, monotonic_ms());
+		return 0;
+	}
+
+	if (bus_handle(l->bus, pfds, n) < 0) {
+		logind_lost(l);
+		return 0;
+	}
+
+	while (dbus_connection_dispatch(l->conn) == DBUS_DISPATCH_DATA_REMAINS)
+		;
+
+	return 0;
+}
+
+void
+logind_set_idle(Logind *l, bool idle)
+{
+	if (!l || l->idle_hint == idle)
+		return;
+
+	l->idle_hint = idle;
+
+	verbose(l->verbose, "[LOGIND] SetIdleHint(%s)%s", idle ? "true" : "false",
+	        l->dry_run ? " (dry run)" : "");
+
+	/* Before the session is known, session_resolved() sends it */
+	if (!l->dry_run && l->session[0])
+		session_call_bool(l, "SetIdleHint", idle);
+}
+
+unsigned int
+logind_events(Logind *l)
+{
+	unsigned int ev;
+
+	if (!l)
+		return 0;
+
+	ev = l->events;
+	l->events = 0;
+	return ev;
+}
+
+void
+logind_sleep_release(Logind *l)
+{
+	if (!l || l->sleep_fd < 0)
+		return;
+
+	close(l->sleep_fd);
+	l->sleep_fd = -1;
+	verbose(l->verbose, "[LOGIND] sleep delay lock released");
+}
+
+void
+logind_sleep_acquire(Logind *l)
+{
+	if (l)
+		(void)sleep_lock_take(l);
+}
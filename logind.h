@@ -0,0 +1,79 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef XCOFFEEBREAK_LOGIND_H
+#define XCOFFEEBREAK_LOGIND_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Events reported by logind_events() */
+enum {
+	LOGIND_EV_SLEEP  = 1 << 0,  /* PrepareForSleep(true), delay lock held */
+	LOGIND_EV_RESUME = 1 << 1,  /* PrepareForSleep(false) */
+	LOGIND_EV_LOCK   = 1 << 2,  /* Session.Lock, e.g. loginctl lock-session */
+	LOGIND_EV_UNLOCK = 1 << 3,  /* Session.Unlock */
+};
+
+typedef struct Logind Logind;
+
+/*
+ * Connect to systemd-logind on the system bus (DBUS_SYSTEM_BUS_ADDRESS
+ * is honored), then resolve this process' session and take a sleep
+ * delay inhibitor lock. Neither is waited for: both complete from
+ * logind_dispatch(), idle hints set meanwhile are sent once the session
+ * is known.
+ *
+ * verbose: enable logging.
+ * dry_run: log idle hints instead of sending them.
+ *
+ * Returns an initialized structure on success,
+ * NULL on failiure.
+ */
+Logind *logind_init(bool verbose, bool dry_run);
+
+/* Close and free a logind handle (safe to call with NULL). */
+void logind_cleanup(Logind *l);
+
+/*
+ * Time until the next libdbus timeout on the system bus, or the next
+ * reconnect attempt once it was lost.
+ *
+ * Returns ms (0 if already due), -1 if nothing is scheduled.
+ */
+int logind_timeout_ms(const Logind *l);
+
+/* System bus fds to poll, see mpris_pollfds(). */
+size_t logind_pollfds(const Logind *l, const struct pollfd **pfds);
+
+/*
+ * Hand back the entries from logind_pollfds() with revents filled in
+ * (n may be 0 on timeout) and dispatch pending messages.
+ *
+ * A lost system bus is reconnected here with backoff, then the session
+ * is resolved and the sleep inhibitor taken again. A restarted logind
+ * gets a fresh inhibitor too.
+ *
+ * Returns 0 on success, -1 on an invalid handle.
+ */
+int logind_dispatch(Logind *l, const struct pollfd *pfds, size_t n);
+
+/*
+ * Publish the session's IdleHint. Only edges reach the bus; repeated
+ * calls with the same value are free.
+ */
+void logind_set_idle(Logind *l, bool idle);
+
+/* Collect and clear the LOGIND_EV_* bits seen since the last call. */
+unsigned int logind_events(Logind *l);
+
+/*
+ * Drop the sleep delay lock, letting a pending suspend proceed.
+ * Call once the session is locked after LOGIND_EV_SLEEP.
+ */
+void logind_sleep_release(Logind *l);
+
+/* Re-take the sleep delay lock after LOGIND_EV_RESUME (no-op if held). */
+void logind_sleep_acquire(Logind *l);
+
+#endif /* XCOFFEEBREAK_LOGIND_H */
@@ -0,0 +1,74 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * logind.h for builds without systemd-logind (make LOGIND=0): behaves
+ * like a system without logind, sleep is then only noticed by the clock
+ * jump fallback.
+ */
+
+#include "logind.h"
+#include "utils.h"
+
+Logind *
+logind_init(bool v, bool dry_run)
+{
+	(void)dry_run;
+	verbose(v, "[LOGIND] not built in (LOGIND=0)");
+	return NULL;
+}
+
+void
+logind_cleanup(Logind *l)
+{
+	(void)l;
+}
+
+int
+logind_timeout_ms(const Logind *l)
+{
+	(void)l;
+	return -1;
+}
+
+size_t
+logind_pollfds(const Logind *l, const struct pollfd **pfds)
+{
+	(void)l;
+	*pfds = NULL;
+	return 0;
+}
+
+int
+logind_dispatch(Logind *l, const struct pollfd *pfds, size_t n)
+{
+	(void)l;
+	(void)pfds;
+	(void)n;
+	return -1;
+}
+
+void
+logind_set_idle(Logind *l, bool idle)
+{
+	(void)l;
+	(void)idle;
+}
+
+unsigned int
+logind_events(Logind *l)
+{
+	(void)l;
+	return 0;
+}
+
+void
+logind_sleep_release(Logind *l)
+{
+	(void)l;
+}
+
+void
+logind_sleep_acquire(Logind *l)
+{
+	(void)l;
+}
@@ -0,0 +1,224 @@
+/* See LICENSE file for copyright and license details. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "utils.h"
+
+#define METRICS_BUF_SIZE 8192
+
+typedef struct {
+	const char *name;
+	const char *help;
+} MetricInfo;
+
+static const MetricInfo counter_info[MET_COUNTERS] = {
+	[MET_LOOP_ITERATIONS]  = { "xcoffeebreak_loop_iterations",          "Main loop iterations" },
+	[MET_DBUS_SIGNALS]     = { "xcoffeebreak_dbus_messages",            "Session bus messages dispatched" },
+	[MET_MPRIS_RESYNCS]    = { "xcoffeebreak_mpris_resyncs",            "Debounced PlaybackStatus resyncs" },
+};
+
+static const MetricInfo histogram_info[MET_HISTOGRAMS] = {
+	[MET_X11_IDLE]   = { "xcoffeebreak_x11_idle_query_seconds",     "XScreenSaverQueryInfo round trip" },
+	[MET_TRANSITION] = { "xcoffeebreak_transition_latency_seconds", "Idle threshold crossed to commands started" },
+};
+
+/* Upper bounds in us; one more implicit +Inf bucket */
+static const unsigned long long bucket_us[] = {
+	100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+	100000, 250000, 500000, 1000000, 2500000,
+};
+#define NBUCKETS (sizeof(bucket_us) / sizeof(bucket_us[0]))
+
+typedef struct {
+	char buf[METRICS_BUF_SIZE];
+	size_t len;
+} Buf;
+
+typedef struct {
+	unsigned long long buckets[NBUCKETS + 1];  /* not cumulative */
+	unsigned long long sum_us;
+	unsigned long long count;
+} Histogram;
+
+static unsigned long long g_counters[MET_COUNTERS];
+static Histogram g_histograms[MET_HISTOGRAMS];
+static char g_path[PATH_MAX];  /* empty: file output disabled */
+static Buf g_buf;              /* formatting scratch, not on the stack */
+
+/* ------------------------------ formatting ------------------------------- */
+
+static void
+buf_printf(Buf *b, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (b->len >= sizeof(b->buf))
+		return;
+
+	va_start(ap, fmt);
+	n = vsnprintf(b->buf + b->len, sizeof(b->buf) - b->len, fmt, ap);
+	va_end(ap);
+
+	if (n > 0)
+		b->len += (size_t)n;
+	if (b->len > sizeof(b->buf))
+		b->len = sizeof(b->buf);
+}
+
+static void
+format_all(Buf *b)
+{
+	b->len = 0;
+
+	for (size_t i = 0; i < MET_COUNTERS; i++) {
+		const MetricInfo *mi = &counter_info[i];
+
+		/* Family named x_total, as the Prometheus text format wants */
+		buf_printf(b, "# TYPE %s_total counter\n# HELP %s_total %s.\n%s_total %llu\n",
+		           mi->name, mi->name, mi->help, mi->name, g_counters[i]);
+	}
+
+	for (size_t i = 0; i < MET_HISTOGRAMS; i++) {
+		const MetricInfo *mi = &histogram_info[i];
+		const Histogram *h = &g_histograms[i];
+		unsigned long long cum = 0;
+
+		buf_printf(b, "# TYPE %s histogram\n# HELP %s %s.\n", mi->name, mi->name, mi->help);
+
+		for (size_t k = 0; k < NBUCKETS; k++) {
+			cum += h->buckets[k];
+			buf_printf(b, "%s_bucket{le=\"%llu.%06llu\"} %llu\n", mi->name,
+			           bucket_us[k] / 1000000ULL, bucket_us[k] % 1000000ULL, cum);
+		}
+		cum += h->buckets[NBUCKETS];
+
+		buf_printf(b, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %llu.%06llu\n%s_count %llu\n",
+		           mi->name, cum, mi->name, h->sum_us / 1000000ULL, h->sum_us % 1000000ULL,
+		           mi->name, h->count);
+	}
+}
+
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, buf, len);
+
+		if (n < 0)
+			return -1;
+		buf += n;
+		len -= (size_t)n;
+	}
+
+	return 0;
+}
+
+/* ----------------------------- metrics public ---------------------------- */
+
+void
+metrics_init(bool v)
+{
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+
+	g_path[0] = '\0';
+
+	if (!dir || !*dir ||
+	    snprintf(g_path, sizeof(g_path), "%s/" METRICS_FILE, dir) >= (int)sizeof(g_path)) {
+		g_path[0] = '\0';
+		verbose(v, "[METRICS] XDG_RUNTIME_DIR not usable, no metrics file");
+		return;
+	}
+
+	verbose(v, "[METRICS] writing %s every %d s", g_path, METRICS_WRITE_S);
+}
+
+void
+metrics_cleanup(void)
+{
+	if (g_path[0])
+		unlink(g_path);
+}
+
+void
+metrics_add(MetricCounter c, unsigned long n)
+{
+	g_counters[c] += n;
+}
+
+void
+metrics_observe(MetricHistogram h, unsigned long long us)
+{
+	Histogram *hg = &g_histograms[h];
+	size_t k = 0;
+
+	while (k < NBUCKETS && us > bucket_us[k])
+		k++;
+
+	hg->buckets[k]++;
+	hg->sum_us += us;
+	hg->count++;
+}
+
+unsigned long long
+metrics_now_us(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+
+	return (unsigned long long)ts.tv_sec * 1000000ULL +
+	       (unsigned long long)ts.tv_nsec / 1000ULL;
+}
+
+void
+metrics_dump(int fd)
+{
+	format_all(&g_buf);
+	(void)write_all(fd, g_buf.buf, g_buf.len);
+}
+
+void
+metrics_write(void)
+{
+	char tmp[PATH_MAX + 4];
+	int fd, ret;
+
+	if (!g_path[0])
+		return;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", g_path) >= (int)sizeof(tmp))
+		return;
+
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+		warn("[METRICS] %s:", tmp);
+		return;
+	}
+
+	format_all(&g_buf);
+	ret = write_all(fd, g_buf.buf, g_buf.len);
+	if (close(fd) < 0)
+		ret = -1;
+
+	/* Scrapers only ever see a complete file */
+	if (ret < 0) {
+		warn("[METRICS] %s:", tmp);
+		unlink(tmp);
+		return;
+	}
+
+	if (rename(tmp, g_path) < 0) {
+		warn("[METRICS] rename %s:", g_path);
+		unlink(tmp);
+	}
+}
@@ -0,0 +1,50 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef XCOFFEEBREAK_METRICS_H
+#define XCOFFEEBREAK_METRICS_H
+
+#include <stdbool.h>
+
+#define METRICS_FILE    "xcoffeebreak.prom"  /* in $XDG_RUNTIME_DIR */
+#define METRICS_WRITE_S 60                   /* file refresh interval */
+
+/* Monotonic counters */
+typedef enum {
+	MET_LOOP_ITERATIONS = 0,
+	MET_DBUS_SIGNALS,         /* messages through dispatch_all_messages() */
+	MET_MPRIS_RESYNCS,        /* debounced async status Gets */
+	MET_COUNTERS,
+} MetricCounter;
+
+/* Fixed-bucket latency histograms, observed in microseconds */
+typedef enum {
+	MET_X11_IDLE = 0,         /* x11_idle_ms() round trip */
+	MET_TRANSITION,           /* idle threshold crossed -> commands started */
+	MET_HISTOGRAMS,
+} MetricHistogram;
+
+/*
+ * Resolve $XDG_RUNTIME_DIR/METRICS_FILE. Counting works without it,
+ * only metrics_write() is disabled.
+ */
+void metrics_init(bool verbose);
+
+/* Remove the metrics file, it would go stale once we exit. */
+void metrics_cleanup(void);
+
+void metrics_add(MetricCounter c, unsigned long n);
+void metrics_observe(MetricHistogram h, unsigned long long us);
+
+/* CLOCK_MONOTONIC in us, for timing observations; 0 on failure. */
+unsigned long long metrics_now_us(void);
+
+/* Write everything in Prometheus text format to fd. */
+void metrics_dump(int fd);
+
+/*
+ * Replace the metrics file atomically (temporary file + rename), for the
+ * node_exporter textfile collector.
+ */
+void metrics_write(void);
+
+#endif /* XCOFFEEBREAK_METRICS_H */
@@ -1,48 +1,95 @@
 /* See LICENSE file for copyright and license details. */
 
 #include <dbus/dbus.h>
-#include <errno.h>
 #include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
+#include <strings.h>
+#include "bus.h"
+#include "log.h"
+#include "metrics.h"
 #include "mpris.h"
+#include "pattern.h"
+#include "screensaver.h"
 #include "utils.h"
 
-#define MPRIS_FALLBACK_POLL_S 10    /* 0 = disabled */
-#define MPRIS_STARVATION_MS   5000  /* force re-sync if no dbus activity */
-#define DBUS_CALL_TIMEOUT_MS  200   /* Timeout for blocking DBus calls (ms) */
+#define MPRIS_RESYNC_MIN_MS   2000  /* min interval between Gets per player */
+#define MPRIS_RECONNECT_MIN_MS   1000    /* first retry after losing the bus */
+#define MPRIS_RECONNECT_MAX_MS   60000   /* retry backoff ceiling */
+#define MPRIS_RECONNECT_GRACE_MS 600000  /* keep cached playing state this long */
+#define MPRIS_STALE_SAMPLE_MS 30000 /* Position sampling period, at most */
+#define DBUS_ASYNC_TIMEOUT_MS 2000  /* Timeout for async DBus calls (ms) */
+#define MPRIS_NAME_MAX (DBUS_MAXIMUM_NAME_LENGTH + 1)
+
+/*
+ * Two calls in flight per player at most, plus ListNames and, right
+ * after connecting, Hello, three AddMatch and RequestName
+ */
+#if 2 * MPRIS_MAX_PLAYERS + 6 > BUS_MAX_TIMEOUTS
+#error "BUS_MAX_TIMEOUTS too small for MPRIS_MAX_PLAYERS"
+#endif
+
+typedef enum {
+	MEDIA_UNKNOWN = 0,       /* no or unclassified Metadata: treated as video */
+	MEDIA_AUDIO,
+	MEDIA_VIDEO,
+} Media;
+
+static const char *const media_names[] = {
+	[MEDIA_UNKNOWN] = "unknown",
+	[MEDIA_AUDIO]   = "audio",
+	[MEDIA_VIDEO]   = "video",
+};
 
 typedef struct Player {
-	char *name;              /* org.mpris.MediaPlayer2.* */
+	char  name[MPRIS_NAME_MAX];  /* org.mpris.MediaPlayer2.* */
+	char  owner[MPRIS_NAME_MAX]; /* unique bus name (":1.42"), signal sender, "" = unknown */
 	bool  is_playing;        /* cached */
+	bool  seen;              /* listed by the last ListNames */
+	bool  ignored;           /* excluded by policy, never inhibits */
+	unsigned long long resync_at_ms;   /* pending status Get, 0 = none */
+	unsigned long long last_resync_ms; /* last status Get issued */
+	DBusPendingCall *pending;          /* async status Get in flight */
+	bool  syncing;                     /* discovery not finished for it */
+	long long position_us;             /* last sampled Position, -1 = none */
+	unsigned long long position_moved_ms; /* when Position last advanced */
+	bool  stale;                       /* "Playing" but Position frozen */
+	unsigned long long metadata;       /* hash of xesam:url and mpris:trackid, 0 = none */
+	Media media;             /* what Metadata hints at */
+	DBusPendingCall *pos_pending;      /* async Position Get in flight */
 	struct Player *next;
 } Player;
 
-typedef struct WatchEnt {
-	DBusWatch *watch;
-	int fd;
-} WatchEnt;
-
 struct Mpris {
-	DBusConnection *conn;
-
-	WatchEnt *watches;
-	size_t nwatches;
-	size_t cap_watches;
+	Bus *bus;
+	DBusConnection *conn;    /* bus_conn(bus) */
+	ScreenSaver *ss;         /* org.freedesktop.ScreenSaver inhibitors */
 
 	Player *players;
+	Player slots[MPRIS_MAX_PLAYERS];  /* players[] come from here */
+	Player *free_slots;               /* released slots, linked by next */
+	unsigned int nslots;              /* slots handed out at least once */
 	unsigned int playing_count;
+	unsigned int resync_count;   /* players with resync_at_ms set */
+	unsigned int stale_count;    /* playing players with stale set */
 	bool verbose;
 
-	struct pollfd *pfds;
-	size_t pfds_cap;
+	unsigned long stale_ms;      /* frozen Position this long = stale, 0 = off */
+	unsigned long long sample_at_ms; /* next Position sample, 0 = none */
 
-	unsigned long long last_activity_ms;
-#if MPRIS_FALLBACK_POLL_S > 0
-	unsigned long long last_fallback_ms;
-#endif
+	const PatternList *allow;    /* player policy, owned by the caller */
+	const PatternList *deny;
+
+	size_t nmsgs;                /* messages seen by mpris_filter() */
+
+	DBusPendingCall *list_pending;    /* discovery ListNames in flight */
+	unsigned int sync_left;           /* players with syncing set */
+	unsigned long long sync_start_ms; /* connect time discovery, 0 = done */
+
+	unsigned long long lost_at_ms;  /* connection lost, 0 = connected */
+	unsigned long long retry_at_ms; /* next reconnect attempt */
+	unsigned long retry_backoff_ms;
 };
 
 static Player *
@@ -56,32 +103,89 @@ player_find(Mpris *m, const char *name)
 	return NULL;
 }
 
+static Player *
+player_find_by_owner(Player *p, const char *owner)
+{
+	for (; p; p = p->next)
+		if (p->owner[0] && streq(p->owner, owner))
+			return p;
+	return NULL;
+}
+
 static Player *
 player_add(Mpris *m, const char *name)
 {
+	size_t len = strlen(name);
 	Player *p;
-	
-	p = calloc(1, sizeof(*p));
-	if (!p) {
-		warn("[MPRIS] calloc failed");
-		return NULL;
-	}
 
-	p->name = strdup(name);
-	if (!p->name) {
-		warn("[MPRIS] strdup failed");
-		free(p);
+	if (len >= MPRIS_NAME_MAX)
+		return NULL;  /* not a bus name */
+
+	if ((p = m->free_slots)) {
+		m->free_slots = p->next;
+	} else if (m->nslots < MPRIS_MAX_PLAYERS) {
+		p = &m->slots[m->nslots++];
+	} else {
+		warn("[MPRIS] more than %d players, ignoring %s", MPRIS_MAX_PLAYERS, name);
 		return NULL;
 	}
 
+	memset(p, 0, sizeof(*p));
+	memcpy(p->name, name, len + 1);
+	p->position_us = -1;
+
+	/* Policy is decided once; ignored players only track their owner */
+	p->ignored = (m->allow && !patterns_empty(m->allow) && !patterns_match(m->allow, name)) ||
+	             (m->deny && patterns_match(m->deny, name));
+
 	p->next = m->players;
 	m->players = p;
 	
-	verbose(m->verbose, "[MPRIS] player added: %s", name);
+	log_fields(m->verbose, &(LogFields){ NULL, p->name, -1 },
+	           "[MPRIS] player added: %s%s", name, p->ignored ? " (ignored)" : "");
 	
 	return p;
 }
 
+static void
+player_cancel_pending(Player *p)
+{
+	if (p->pending) {
+		dbus_pending_call_cancel(p->pending);
+		dbus_pending_call_unref(p->pending);
+		p->pending = NULL;
+	}
+	if (p->pos_pending) {
+		dbus_pending_call_cancel(p->pos_pending);
+		dbus_pending_call_unref(p->pos_pending);
+		p->pos_pending = NULL;
+	}
+}
+
+static void
+player_free(Mpris *m, Player *p)
+{
+	player_cancel_pending(p);
+	p->next = m->free_slots;
+	m->free_slots = p;
+}
+
+static void
+players_clear(Mpris *m)
+{
+	while (m->players) {
+		Player *p = m->players;
+
+		m->players = p->next;
+		player_free(m, p);
+	}
+
+	m->playing_count = 0;
+	m->resync_count = 0;
+	m->stale_count = 0;
+	m->sync_left = 0;
+}
+
 static void
 player_remove(Mpris *m, const char *name)
 {
@@ -94,29 +198,73 @@ player_remove(Mpris *m, const char *name)
 		if (streq(p->name, name)) {
 			if (p->is_playing && m->playing_count > 0)
 				m->playing_count--;
+			if (p->resync_at_ms && m->resync_count > 0)
+				m->resync_count--;
+			if (p->stale && m->stale_count > 0)
+				m->stale_count--;
+			if (p->syncing && m->sync_left > 0)
+				m->sync_left--;
 			*pp = p->next;
 
-			verbose(m->verbose, "[MPRIS] player removed: %s", name);
+			log_fields(m->verbose, &(LogFields){ NULL, p->name, -1 },
+			           "[MPRIS] player removed: %s", name);
 
-			free(p->name);
-			free(p);
+			player_free(m, p);
 			return;
 		}
 		pp = &p->next;
 	}
 }
 
+static void
+player_set_owner(Mpris *m, Player *p, const char *owner)
+{
+	size_t len;
+
+	if (!p || !owner)
+		return;
+
+	if (streq(p->owner, owner) || (len = strlen(owner)) >= MPRIS_NAME_MAX)
+		return;
+
+	verbose(m->verbose, "[MPRIS] %s owned by %s", p->name, owner);
+	memcpy(p->owner, owner, len + 1);
+}
+
+static void
+player_set_stale(Mpris *m, Player *p, bool stale)
+{
+	if (p->stale == stale)
+		return;
+
+	p->stale = stale;
+	if (stale) {
+		m->stale_count++;
+		verbose(m->verbose, "[MPRIS] %s: Position frozen for %lu s, not inhibiting",
+		        p->name, m->stale_ms / 1000UL);
+	} else {
+		if (m->stale_count > 0)
+			m->stale_count--;
+		verbose(m->verbose, "[MPRIS] %s: Position moving again", p->name);
+	}
+}
+
 static void
 player_set_playing(Mpris *m, Player *p, bool playing)
 {
-	if (!p)
+	if (!p || p->ignored)
 		return;
 
 	if (p->is_playing == playing)
 		return;
 
-	verbose(m->verbose, "[MPRIS] %s %s -> %s", p->name,
-	        p->is_playing ? "playing" : "stopped", playing ? "playing" : "stopped");
+	log_fields(m->verbose, &(LogFields){ NULL, p->name, -1 }, "[MPRIS] %s %s -> %s", p->name,
+	           p->is_playing ? "playing" : "stopped", playing ? "playing" : "stopped");
+
+	/* Fresh playback, staleness is judged from scratch */
+	player_set_stale(m, p, false);
+	p->position_us = -1;
+	p->position_moved_ms = monotonic_ms();
 
 	p->is_playing = playing;
 	if (playing)
@@ -125,292 +273,770 @@ player_set_playing(Mpris *m, Player *p, bool playing)
 		m->playing_count--;
 }
 
-static int
-watch_index_by_ptr(Mpris *m, DBusWatch *w)
+/*
+ * Change detector for Metadata, in place of copies of unbounded
+ * strings: FNV-1a over url and trackid. Returns 0 if both are empty.
+ */
+static unsigned long long
+metadata_hash(const char *url, const char *trackid)
 {
-	for (size_t i = 0; i < m->nwatches; i++)
-		if (m->watches[i].watch == w)
-			return (int)i;
-	return -1;
+	unsigned long long h = 14695981039346656037ULL;
+	const char *s;
+
+	if ((!url || !*url) && (!trackid || !*trackid))
+		return 0;
+
+	for (s = url ? url : ""; *s; s++)
+		h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+	h = (h ^ 0xffU) * 1099511628211ULL;  /* never part of a string */
+	for (s = trackid ? trackid : ""; *s; s++)
+		h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+
+	return h ? h : 1;
+}
+
+/* Last path suffix of url (query and fragment ignored) is one of exts */
+static bool
+url_has_ext(const char *url, const char *const *exts, size_t nexts)
+{
+	const char *end = url + strcspn(url, "?#");
+	size_t n;
+
+	for (size_t i = 0; i < nexts; i++) {
+		n = strlen(exts[i]);
+		if ((size_t)(end - url) >= n && strncasecmp(end - n, exts[i], n) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * MPRIS has no media type, so guess from the URL: a known file
+ * extension or site. Only a positive audio hint lets the session lock;
+ * browsers often send no URL or one of their own, which stays unknown
+ * and is handled like video.
+ */
+static Media
+url_media(const char *url)
+{
+	static const char *const video_exts[] = {
+		".mp4", ".m4v", ".mkv", ".webm", ".avi", ".mov", ".wmv",
+		".flv", ".mpg", ".mpeg", ".ogv", ".ts",
+	};
+	static const char *const audio_exts[] = {
+		".mp3", ".flac", ".ogg", ".oga", ".opus", ".m4a", ".aac",
+		".wav", ".wma", ".aiff", ".ape", ".mka", ".wv",
+	};
+	static const char *const video_sites[] = {
+		"youtube.com/watch", "youtu.be/", "vimeo.com/", "twitch.tv/",
+		"netflix.com/watch",
+	};
+	/* Checked first: music.youtube.com/watch is audio */
+	static const char *const audio_sites[] = {
+		"music.youtube.com/", "open.spotify.com/", "soundcloud.com/",
+		"bandcamp.com/",
+	};
+
+	if (!url || !*url)
+		return MEDIA_UNKNOWN;
+
+	for (size_t i = 0; i < sizeof(audio_sites) / sizeof(audio_sites[0]); i++)
+		if (strstr(url, audio_sites[i]))
+			return MEDIA_AUDIO;
+	for (size_t i = 0; i < sizeof(video_sites) / sizeof(video_sites[0]); i++)
+		if (strstr(url, video_sites[i]))
+			return MEDIA_VIDEO;
+
+	if (url_has_ext(url, video_exts, sizeof(video_exts) / sizeof(video_exts[0])))
+		return MEDIA_VIDEO;
+	if (url_has_ext(url, audio_exts, sizeof(audio_exts) / sizeof(audio_exts[0])))
+		return MEDIA_AUDIO;
+
+	return MEDIA_UNKNOWN;
+}
+
+static void
+player_set_metadata(Mpris *m, Player *p, const char *url, const char *trackid)
+{
+	unsigned long long h = metadata_hash(url, trackid);
+
+	if (h == p->metadata)
+		return;
+
+	p->metadata = h;
+	p->media = url_media(url);
+	verbose(m->verbose, "[MPRIS] %s: %s %s", p->name, media_names[p->media],
+	        url && *url ? url : (trackid && *trackid ? trackid : "(no metadata)"));
+}
+
+/* Connect time discovery finished: every listed player answered or failed */
+static void
+discovery_check_done(Mpris *m)
+{
+	unsigned int n = 0;
+
+	if (!m->sync_start_ms || m->list_pending || m->sync_left)
+		return;
+
+	for (const Player *p = m->players; p; p = p->next)
+		n++;
+
+	verbose(m->verbose, "[MPRIS] discovered %u players in %llu ms", n,
+	        monotonic_ms() - m->sync_start_ms);
+	m->sync_start_ms = 0;
+}
+
+static void
+player_synced(Mpris *m, Player *p)
+{
+	if (!p->syncing)
+		return;
+
+	p->syncing = false;
+	if (m->sync_left > 0)
+		m->sync_left--;
+	discovery_check_done(m);
+}
+
+/* --------------------------- MPRIS DBus helpers -------------------------- */
+
+/*
+ * Send msg (consumed) with fn as the reply handler.
+ * Returns the pending call, NULL on failiure.
+ */
+static DBusPendingCall *
+send_with_notify(Mpris *m, DBusMessage *msg, DBusPendingCallNotifyFunction fn)
+{
+	DBusPendingCall *pc = NULL;
+
+	if (!dbus_connection_send_with_reply(m->conn, msg, &pc, DBUS_ASYNC_TIMEOUT_MS) || !pc) {
+		dbus_message_unref(msg);
+		return NULL;
+	}
+	dbus_message_unref(msg);
+
+	if (!dbus_pending_call_set_notify(pc, fn, m, NULL)) {
+		dbus_pending_call_cancel(pc);
+		dbus_pending_call_unref(pc);
+		return NULL;
+	}
+
+	return pc;
+}
+
+/* org.freedesktop.DBus.Properties.Get("org.mpris.MediaPlayer2.Player", prop) */
+static DBusMessage *
+new_get_player_property(const char *service, const char *prop)
+{
+	DBusMessage *msg;
+	const char *iface = "org.mpris.MediaPlayer2.Player";
+
+	msg = dbus_message_new_method_call(
+		service,
+		"/org/mpris/MediaPlayer2",
+		"org.freedesktop.DBus.Properties",
+		"Get");
+	if (!msg)
+		return NULL;
+
+	if (!dbus_message_append_args(msg,
+	                             DBUS_TYPE_STRING, &iface,
+	                             DBUS_TYPE_STRING, &prop,
+	                             DBUS_TYPE_INVALID)) {
+		dbus_message_unref(msg);
+		return NULL;
+	}
+
+	return msg;
+}
+
+static DBusMessage *
+new_get_playbackstatus(const char *service)
+{
+	return new_get_player_property(service, "PlaybackStatus");
 }
 
 static int
-watches_reserve(Mpris *m, size_t need)
+parse_playbackstatus(DBusMessage *reply, int *out_playing)
 {
-	WatchEnt *nw;
-	size_t newcap;
+	DBusMessageIter it, v;
+	const char *status = NULL;
 
-	if (need <= m->cap_watches)
-		return 0;
+	if (dbus_message_get_type(reply) != DBUS_MESSAGE_TYPE_METHOD_RETURN)
+		return -1;
 
-	newcap = m->cap_watches ? m->cap_watches * 2 : 16;
-	if (newcap < need)
-		newcap = need;
+	/* reply has signature: (v) */
+	if (!dbus_message_iter_init(reply, &it) ||
+	    dbus_message_iter_get_arg_type(&it) != DBUS_TYPE_VARIANT)
+		return -1;
 
-	nw = realloc(m->watches, newcap * sizeof(*nw));
-	if (!nw)
+	dbus_message_iter_recurse(&it, &v);
+	if (dbus_message_iter_get_arg_type(&v) != DBUS_TYPE_STRING)
 		return -1;
 
-	m->watches = nw;
-	m->cap_watches = newcap;
+	dbus_message_iter_get_basic(&v, &status);
+	*out_playing = (status && streq(status, "Playing")) ? 1 : 0;
 	return 0;
 }
 
-static dbus_bool_t
-watch_add(DBusWatch *watch, void *data)
+static void
+playbackstatus_notify(DBusPendingCall *pc, void *data)
 {
 	Mpris *m = (Mpris *)data;
-	int fd;
+	DBusMessage *reply;
+	Player *p;
+	int playing = 0;
 
-	if (watch_index_by_ptr(m, watch) >= 0)
-		return TRUE;
+	for (p = m->players; p && p->pending != pc; p = p->next)
+		;
+	if (!p)
+		return;
+
+	p->pending = NULL;
+	reply = dbus_pending_call_steal_reply(pc);
+	dbus_pending_call_unref(pc);
+
+	/* Errors are not fatal: player might not implement it or be gone */
+	if (reply && parse_playbackstatus(reply, &playing) == 0)
+		player_set_playing(m, p, playing);
 
-	if (watches_reserve(m, m->nwatches + 1)) {
-		warn("[MPRIS] out of memory (watch_add)");
-		return FALSE;
+	if (reply)
+		dbus_message_unref(reply);
+	player_synced(m, p);
+}
+
+/* Send an async PlaybackStatus Get; the reply lands in playbackstatus_notify(). */
+static int
+dbus_send_get_playbackstatus(Mpris *m, Player *p)
+{
+	DBusMessage *msg;
+
+	if (!(msg = new_get_playbackstatus(p->name)))
+		return -1;
+
+	if (!(p->pending = send_with_notify(m, msg, playbackstatus_notify)))
+		return -1;
+	return 0;
+}
+
+static void
+position_notify(DBusPendingCall *pc, void *data)
+{
+	Mpris *m = (Mpris *)data;
+	DBusMessage *reply;
+	DBusMessageIter it, v;
+	Player *p;
+	dbus_int64_t pos;
+	unsigned long long now_ms;
+
+	for (p = m->players; p && p->pos_pending != pc; p = p->next)
+		;
+	if (!p)
+		return;
+
+	p->pos_pending = NULL;
+	reply = dbus_pending_call_steal_reply(pc);
+	dbus_pending_call_unref(pc);
+
+	if (!reply)
+		return;
+
+	/* Players without Position (or erroring) are never judged stale */
+	if (dbus_message_get_type(reply) != DBUS_MESSAGE_TYPE_METHOD_RETURN ||
+	    !dbus_message_iter_init(reply, &it) ||
+	    dbus_message_iter_get_arg_type(&it) != DBUS_TYPE_VARIANT) {
+		dbus_message_unref(reply);
+		return;
 	}
 
-	fd = dbus_watch_get_unix_fd(watch);
-	m->watches[m->nwatches].watch = watch;
-	m->watches[m->nwatches].fd = fd;
-	m->nwatches++;
+	dbus_message_iter_recurse(&it, &v);
+	if (dbus_message_iter_get_arg_type(&v) != DBUS_TYPE_INT64) {
+		dbus_message_unref(reply);
+		return;
+	}
+
+	dbus_message_iter_get_basic(&v, &pos);
+	dbus_message_unref(reply);
+
+	if (!p->is_playing || !(now_ms = monotonic_ms()))
+		return;
+
+	if ((long long)pos != p->position_us) {
+		p->position_us = (long long)pos;
+		p->position_moved_ms = now_ms;
+		player_set_stale(m, p, false);
+	} else if (now_ms - p->position_moved_ms >= m->stale_ms) {
+		player_set_stale(m, p, true);
+	}
+}
+
+static int
+dbus_send_get_position(Mpris *m, Player *p)
+{
+	DBusMessage *msg;
+
+	if (!(msg = new_get_player_property(p->name, "Position")))
+		return -1;
+
+	if (!(p->pos_pending = send_with_notify(m, msg, position_notify)))
+		return -1;
+	return 0;
+}
+
+/* Player properties found in an a{sv}; strings point into the message */
+typedef struct {
+	const char *status;      /* PlaybackStatus, NULL if absent */
+	bool has_metadata;       /* Metadata present (url/trackid may be NULL) */
+	const char *url;
+	const char *trackid;
+} PlayerProps;
+
+static int
+read_variant_string(DBusMessageIter *variant, const char **out)
+{
+	DBusMessageIter sub;
+	int type;
+
+	if (dbus_message_iter_get_arg_type(variant) != DBUS_TYPE_VARIANT)
+		return 0;
+
+	dbus_message_iter_recurse(variant, &sub);
 
-	return TRUE;
+	/* mpris:trackid is an object path, same representation */
+	type = dbus_message_iter_get_arg_type(&sub);
+	if (type != DBUS_TYPE_STRING && type != DBUS_TYPE_OBJECT_PATH)
+		return 0;
+
+	dbus_message_iter_get_basic(&sub, out);
+	return 1;
 }
 
+/* Metadata (variant of a{sv}): pick the fields we cache. */
 static void
-watch_remove(DBusWatch *watch, void *data)
+read_metadata(DBusMessageIter *variant, PlayerProps *props)
 {
-	Mpris *m;
-	int idx;
+	DBusMessageIter sub, array;
+
+	if (dbus_message_iter_get_arg_type(variant) != DBUS_TYPE_VARIANT)
+		return;
+
+	dbus_message_iter_recurse(variant, &sub);
+	if (dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_ARRAY)
+		return;
+
+	props->has_metadata = true;
+	dbus_message_iter_recurse(&sub, &array);
+
+	while (dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_DICT_ENTRY) {
+		DBusMessageIter entry;
+		const char *key = NULL;
+
+		dbus_message_iter_recurse(&array, &entry);
+		if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_STRING)
+			break;
+
+		dbus_message_iter_get_basic(&entry, &key);
+		if (dbus_message_iter_next(&entry)) {
+			if (streq(key, "xesam:url"))
+				(void)read_variant_string(&entry, &props->url);
+			else if (streq(key, "mpris:trackid"))
+				(void)read_variant_string(&entry, &props->trackid);
+		}
+
+		dbus_message_iter_next(&array);
+	}
+}
+
+/* Walk an a{sv} of org.mpris.MediaPlayer2.Player properties. */
+static void
+read_player_props(DBusMessageIter *array, PlayerProps *props)
+{
+	while (dbus_message_iter_get_arg_type(array) == DBUS_TYPE_DICT_ENTRY) {
+		DBusMessageIter entry;
+		const char *key = NULL;
+
+		dbus_message_iter_recurse(array, &entry);
+
+		if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_STRING)
+			break;
+
+		dbus_message_iter_get_basic(&entry, &key);
 
-	m = (Mpris *)data;
-	idx = watch_index_by_ptr(m, watch);
+		if (!dbus_message_iter_next(&entry))
+			break;
+
+		if (streq(key, "PlaybackStatus"))
+			(void)read_variant_string(&entry, &props->status);
+		else if (streq(key, "Metadata"))
+			read_metadata(&entry, props);
+
+		dbus_message_iter_next(array);
+	}
+}
 
-	if (idx < 0)
+/*
+ * Queue a PlaybackStatus Get for a player, coalescing bursts: the first
+ * request after a quiet period is due immediately, later ones collapse
+ * into a single Get MPRIS_RESYNC_MIN_MS after the previous one.
+ */
+static void
+player_schedule_resync(Mpris *m, Player *p)
+{
+	unsigned long long now_ms, due_ms;
+
+	if (p->resync_at_ms || p->ignored)
 		return;
 
-	m->watches[idx] = m->watches[m->nwatches - 1];
-	m->nwatches--;
+	now_ms = monotonic_ms();
+	due_ms = p->last_resync_ms + MPRIS_RESYNC_MIN_MS;
+	p->resync_at_ms = (due_ms > now_ms) ? due_ms : now_ms;
+	if (!p->resync_at_ms)
+		p->resync_at_ms = 1;
+	m->resync_count++;
+}
+
+/* ms until the next pending resync is due (0 if overdue), -1 if none. */
+static long
+resync_next_ms(const Mpris *m, unsigned long long now_ms)
+{
+	long next = -1;
+
+	if (!m->resync_count)
+		return -1;
+
+	for (const Player *p = m->players; p; p = p->next) {
+		long left;
+
+		if (!p->resync_at_ms)
+			continue;
+
+		left = p->resync_at_ms > now_ms ? (long)(p->resync_at_ms - now_ms) : 0;
+		if (next < 0 || left < next)
+			next = left;
+	}
+
+	return next;
 }
 
+/* Issue due resyncs as async Gets. */
 static void
-watch_toggle(DBusWatch *watch, void *data)
+run_due_resyncs(Mpris *m, unsigned long long now_ms)
 {
-	(void)watch;
-	(void)data;
+	if (!m->resync_count)
+		return;
+
+	for (Player *p = m->players; p; p = p->next) {
+		if (!p->resync_at_ms || p->resync_at_ms > now_ms)
+			continue;
+
+		/* Previous Get still in flight: its reply is at most stale by one interval */
+		if (p->pending) {
+			p->resync_at_ms = now_ms + MPRIS_RESYNC_MIN_MS;
+			continue;
+		}
+
+		p->resync_at_ms = 0;
+		p->last_resync_ms = now_ms;
+		m->resync_count--;
+		metrics_add(MET_MPRIS_RESYNCS, 1);
+
+		if (dbus_send_get_playbackstatus(m, p) < 0)
+			verbose(m->verbose, "[MPRIS] %s: status Get failed", p->name);
+	}
 }
 
-static short
-dbus_flags_to_poll(unsigned int flags)
+/*
+ * The one player keeping the session awake, if stale detection is on
+ * and nothing else inhibits. Only then is Position worth sampling: with
+ * several inhibitors a stalled one changes nothing.
+ */
+static Player *
+stale_candidate(const Mpris *m)
 {
-	short ev = 0;
+	if (!m->stale_ms || m->playing_count != 1 || screensaver_is_inhibited(m->ss))
+		return NULL;
 
-	if (flags & DBUS_WATCH_READABLE)
-		ev |= POLLIN;
-	if (flags & DBUS_WATCH_WRITABLE)
-		ev |= POLLOUT;
-	return ev;
+	for (Player *p = m->players; p; p = p->next)
+		if (p->is_playing)
+			return p;
+
+	return NULL;
 }
 
-static unsigned int
-poll_revents_to_dbus(short revents)
+static unsigned long
+stale_sample_ms(const Mpris *m)
 {
-	unsigned int flags = 0;
+	unsigned long ms = m->stale_ms / 4;
 
-	if (revents & POLLIN)
-		flags |= DBUS_WATCH_READABLE;
-	if (revents & POLLOUT)
-		flags |= DBUS_WATCH_WRITABLE;
-	if (revents & POLLERR)
-		flags |= DBUS_WATCH_ERROR;
-	if (revents & POLLHUP)
-		flags |= DBUS_WATCH_HANGUP;
-	return flags;
+	if (ms > MPRIS_STALE_SAMPLE_MS)
+		ms = MPRIS_STALE_SAMPLE_MS;
+	return ms < 1000 ? 1000 : ms;
 }
 
-/* ------------------------ poll() helper utilities ------------------------- */
+/* Sample the sole inhibitor's Position when due (async, one Get in flight). */
+static void
+run_stale_check(Mpris *m, unsigned long long now_ms)
+{
+	Player *p = stale_candidate(m);
 
-static unsigned long long
-monotonic_ms(void)
+	if (!p) {
+		m->sample_at_ms = 0;
+		return;
+	}
+
+	if (m->sample_at_ms && now_ms < m->sample_at_ms)
+		return;
+
+	m->sample_at_ms = now_ms + stale_sample_ms(m);
+
+	if (!p->pos_pending && dbus_send_get_position(m, p) < 0)
+		verbose(m->verbose, "[MPRIS] %s: Position Get failed", p->name);
+}
+
+/* ------------------------------- Discovery ------------------------------- */
+
+/*
+ * Players are discovered without blocking the loop: one ListNames, then
+ * GetNameOwner and (unless ignored) GetAll per player, all async. Their
+ * replies merge into the cached state as they arrive. A player is synced
+ * once its status is known or could not be had.
+ */
+
+static void
+player_props_notify(DBusPendingCall *pc, void *data)
 {
-	struct timespec ts;
+	Mpris *m = (Mpris *)data;
+	DBusMessage *reply;
+	DBusMessageIter it, array;
+	PlayerProps props = { 0 };
+	bool has_status = false;
+	Player *p;
+
+	for (p = m->players; p && p->pending != pc; p = p->next)
+		;
+	if (!p)
+		return;
+
+	p->pending = NULL;
+	reply = dbus_pending_call_steal_reply(pc);
+	dbus_pending_call_unref(pc);
+
+	if (reply && dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_METHOD_RETURN &&
+	    dbus_message_iter_init(reply, &it) &&
+	    dbus_message_iter_get_arg_type(&it) == DBUS_TYPE_ARRAY) {
+		dbus_message_iter_recurse(&it, &array);
+		read_player_props(&array, &props);
 
-	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
-		return 0;
+		if (props.has_metadata)
+			player_set_metadata(m, p, props.url, props.trackid);
+		if ((has_status = props.status != NULL))
+			player_set_playing(m, p, streq(props.status, "Playing"));
+	}
 
-	return (unsigned long long)ts.tv_sec * 1000ULL +
-	       (unsigned long long)ts.tv_nsec / 1000000ULL;
-}
+	if (reply)
+		dbus_message_unref(reply);
 
-static size_t
-pfd_index(const struct pollfd *pfds, size_t nfds, int fd)
-{
-	for (size_t i = 0; i < nfds; i++)
-		if (pfds[i].fd == fd)
-			return i;
-	return (size_t)-1;
+	/* No GetAll, or no status in it: plain Get as fallback */
+	if (has_status || dbus_send_get_playbackstatus(m, p) < 0)
+		player_synced(m, p);
 }
 
-/* --------------------------- MPRIS DBus helpers -------------------------- */
-
+/* Properties.GetAll on the Player interface: status and metadata at once. */
 static int
-dbus_call_get_playbackstatus(Mpris *m, const char *service, int *out_playing)
+dbus_send_get_player_props(Mpris *m, Player *p)
 {
-	DBusMessage *msg, *reply;
-	DBusMessageIter it, v;
-	DBusError err;
+	DBusMessage *msg;
 	const char *iface = "org.mpris.MediaPlayer2.Player";
-	const char *prop  = "PlaybackStatus";
-	const char *status = NULL;
 
-	/* org.freedesktop.DBus.Properties.Get("org.mpris.MediaPlayer2.Player","PlaybackStatus") */
-	msg = dbus_message_new_method_call(
-		service,
-		"/org/mpris/MediaPlayer2",
-		"org.freedesktop.DBus.Properties",
-		"Get");
+	msg = dbus_message_new_method_call(p->name, "/org/mpris/MediaPlayer2",
+	                                   "org.freedesktop.DBus.Properties", "GetAll");
 	if (!msg)
 		return -1;
 
-	if (!dbus_message_append_args(msg,
-	                             DBUS_TYPE_STRING, &iface,
-	                             DBUS_TYPE_STRING, &prop,
-	                             DBUS_TYPE_INVALID)) {
+	if (!dbus_message_append_args(msg, DBUS_TYPE_STRING, &iface, DBUS_TYPE_INVALID)) {
 		dbus_message_unref(msg);
 		return -1;
 	}
 
-	dbus_error_init(&err);
-	/* Use shorter timeout to avoid blocking main loop */
-	reply = dbus_connection_send_with_reply_and_block(m->conn, msg, DBUS_CALL_TIMEOUT_MS, &err);
-	dbus_message_unref(msg);
-
-	if (!reply) {
-		/* Not fatal: player might not implement it yet or disappeared */
-		if (dbus_error_is_set(&err))
-			dbus_error_free(&err);
+	if (!(p->pending = send_with_notify(m, msg, player_props_notify)))
 		return -1;
-	}
+	return 0;
+}
 
-	/* reply has signature: (v) */
-	dbus_message_iter_init(reply, &it);
-	if (dbus_message_iter_get_arg_type(&it) != DBUS_TYPE_VARIANT) {
+static void
+name_owner_notify(DBusPendingCall *pc, void *data)
+{
+	Mpris *m = (Mpris *)data;
+	DBusMessage *reply;
+	const char *owner = NULL;
+	Player *p;
+
+	for (p = m->players; p && p->pending != pc; p = p->next)
+		;
+	if (!p)
+		return;
+
+	p->pending = NULL;
+	reply = dbus_pending_call_steal_reply(pc);
+	dbus_pending_call_unref(pc);
+
+	if (reply && dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_METHOD_RETURN &&
+	    dbus_message_get_args(reply, NULL, DBUS_TYPE_STRING, &owner, DBUS_TYPE_INVALID) && owner)
+		player_set_owner(m, p, owner);
+
+	if (reply)
 		dbus_message_unref(reply);
+
+	/* Name vanished since ListNames: NameOwnerChanged removes it */
+	if (!owner || p->ignored || dbus_send_get_player_props(m, p) < 0)
+		player_synced(m, p);
+}
+
+static int
+dbus_send_get_name_owner(Mpris *m, Player *p)
+{
+	DBusMessage *msg;
+	const char *name = p->name;
+
+	msg = dbus_message_new_method_call(
+		"org.freedesktop.DBus",
+		"/org/freedesktop/DBus",
+		"org.freedesktop.DBus",
+		"GetNameOwner");
+	if (!msg)
 		return -1;
-	}
 
-	dbus_message_iter_recurse(&it, &v);
-	if (dbus_message_iter_get_arg_type(&v) != DBUS_TYPE_STRING) {
-		dbus_message_unref(reply);
+	if (!dbus_message_append_args(msg, DBUS_TYPE_STRING, &name, DBUS_TYPE_INVALID)) {
+		dbus_message_unref(msg);
 		return -1;
 	}
 
-	dbus_message_iter_get_basic(&v, &status);
-	*out_playing = (status && streq(status, "Playing")) ? 1 : 0;
-
-	dbus_message_unref(reply);
+	if (!(p->pending = send_with_notify(m, msg, name_owner_notify)))
+		return -1;
 	return 0;
 }
 
 static void
-initial_sync_players(Mpris *m)
+list_names_notify(DBusPendingCall *pc, void *data)
 {
-	DBusMessage *msg, *reply;
+	Mpris *m = (Mpris *)data;
+	DBusMessage *reply;
 	DBusMessageIter it, arr;
-	DBusError err;
 
-	/* List all bus names, add any org.mpris.MediaPlayer2.*, and read current PlaybackStatus once. */
-	msg = dbus_message_new_method_call(
-		"org.freedesktop.DBus",
-		"/org/freedesktop/DBus",
-		"org.freedesktop.DBus",
-		"ListNames");
-	if (!msg)
+	if (pc != m->list_pending)
 		return;
 
-	dbus_error_init(&err);
-	reply = dbus_connection_send_with_reply_and_block(m->conn, msg, DBUS_CALL_TIMEOUT_MS, &err);
-	dbus_message_unref(msg);
-	if (!reply) {
-		if (dbus_error_is_set(&err))
-			dbus_error_free(&err);
-		return;
-	}
+	m->list_pending = NULL;
+	reply = dbus_pending_call_steal_reply(pc);
+	dbus_pending_call_unref(pc);
 
-	if (!dbus_message_iter_init(reply, &it) ||
+	if (!reply || dbus_message_get_type(reply) != DBUS_MESSAGE_TYPE_METHOD_RETURN ||
+	    !dbus_message_iter_init(reply, &it) ||
 	    dbus_message_iter_get_arg_type(&it) != DBUS_TYPE_ARRAY) {
-		dbus_message_unref(reply);
+		if (reply)
+			dbus_message_unref(reply);
+		discovery_check_done(m);
 		return;
 	}
 
+	for (Player *p = m->players; p; p = p->next)
+		p->seen = false;
+
+	/* Add any org.mpris.MediaPlayer2.* and ask for its owner, then status */
 	dbus_message_iter_recurse(&it, &arr);
-	while (dbus_message_iter_get_arg_type(&arr) == DBUS_TYPE_STRING) {
+	for (; dbus_message_iter_get_arg_type(&arr) == DBUS_TYPE_STRING; dbus_message_iter_next(&arr)) {
 		const char *name = NULL;
+		Player *p;
 
 		dbus_message_iter_get_basic(&arr, &name);
+		if (!name || strncmp(name, "org.mpris.MediaPlayer2.", 23) != 0)
+			continue;
 
-		if (name && strncmp(name, "org.mpris.MediaPlayer2.", 23) == 0) {
-			Player *p;
-			int playing;
+		if (!(p = player_find(m, name)) && !(p = player_add(m, name)))
+			continue;
 
-			p = player_find(m, name);
-			if (!p) {
-				p = player_add(m, name);
-				if (!p)
-					continue;
-			}
+		p->seen = true;
 
-			playing = 0;
-			if (p && dbus_call_get_playbackstatus(m, name, &playing) == 0)
-				player_set_playing(m, p, playing);
-		}
+		/* A Get already in flight (e.g. after NameOwnerChanged) will do */
+		if (p->pending || p->syncing || dbus_send_get_name_owner(m, p) < 0)
+			continue;
 
-		dbus_message_iter_next(&arr);
+		p->syncing = true;
+		m->sync_left++;
 	}
 
 	dbus_message_unref(reply);
-}
 
-/* ------------------------------ Signal parsing --------------------------- */
+	/* Drop players that vanished unnoticed (e.g. while reconnecting) */
+	for (Player *p = m->players, *next; p; p = next) {
+		next = p->next;
+		if (!p->seen)
+			player_remove(m, p->name);
+	}
 
-static int
-read_variant_string(DBusMessageIter *variant, const char **out)
+	discovery_check_done(m);
+}
+
+/* Start discovery (async ListNames), unless it is already running. */
+static void
+players_discover(Mpris *m)
 {
-	DBusMessageIter sub;
+	DBusMessage *msg;
 
-	if (dbus_message_iter_get_arg_type(variant) != DBUS_TYPE_VARIANT)
-		return 0;
+	if (m->list_pending)
+		return;
 
-	dbus_message_iter_recurse(variant, &sub);
+	msg = dbus_message_new_method_call(
+		"org.freedesktop.DBus",
+		"/org/freedesktop/DBus",
+		"org.freedesktop.DBus",
+		"ListNames");
+	if (!msg)
+		return;
 
-	if (dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_STRING)
-		return 0;
+	m->list_pending = send_with_notify(m, msg, list_names_notify);
+}
 
-	dbus_message_iter_get_basic(&sub, out);
-	return 1;
+/* Connection gone: replies will never come. */
+static void
+discovery_cancel(Mpris *m)
+{
+	if (m->list_pending) {
+		dbus_pending_call_cancel(m->list_pending);
+		dbus_pending_call_unref(m->list_pending);
+		m->list_pending = NULL;
+	}
+
+	for (Player *p = m->players; p; p = p->next)
+		p->syncing = false;
+	m->sync_left = 0;
+	m->sync_start_ms = 0;
 }
 
+/* ------------------------------ Signal parsing --------------------------- */
+
 /* org.freedesktop.DBus.Properties.PropertiesChanged */
 static void
 handle_properties_changed(Mpris *m, DBusMessage *msg)
 {
 	Player *p;
 	DBusMessageIter it, array;
+	PlayerProps props = { 0 };
 
 	const char *sender, *iface = NULL;
-	int saw_status = 0;
 
+	/*
+	 * Signals carry the sender's unique name (":1.42"), never the
+	 * well-known org.mpris.MediaPlayer2.* name, so attribute them
+	 * through the owner map kept from GetNameOwner/NameOwnerChanged.
+	 */
 	sender = dbus_message_get_sender(msg);
 	if (!sender)
 		return;
 
-	if (strncmp(sender, "org.mpris.MediaPlayer2.", 23) != 0)
-		return;
-
-	p = player_find(m, sender);
-	if (!p)
-		p = player_add(m, sender);
+	for (p = m->players; (p = player_find_by_owner(p, sender)) && p->ignored; p = p->next)
+		;
 	if (!p)
 		return;
 
@@ -433,40 +1059,22 @@ handle_properties_changed(Mpris *m, DBusMessage *msg)
 		return;
 
 	dbus_message_iter_recurse(&it, &array);
+	read_player_props(&array, &props);
 
-	while (dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_DICT_ENTRY) {
-		DBusMessageIter entry;
-		const char *key = NULL;
-
-		dbus_message_iter_recurse(&array, &entry);
-
-		if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_STRING)
-			break;
-
-		dbus_message_iter_get_basic(&entry, &key);
-
-		if (!dbus_message_iter_next(&entry))
-			break;
-
-		if (streq(key, "PlaybackStatus")) {
-			const char *status = NULL;
-
-			saw_status = 1;
-			if (read_variant_string(&entry, &status)) {
-				player_set_playing(m, p, streq(status, "Playing"));
-			}
-		}
+	/* One unique name may own several MPRIS names (e.g. per-instance) */
+	for (; p; p = player_find_by_owner(p->next, sender)) {
+		if (p->ignored)
+			continue;
 
-		dbus_message_iter_next(&array);
-	}
+		if (props.has_metadata)
+			player_set_metadata(m, p, props.url, props.trackid);
 
-	/* Some players don't include PlaybackStatus in PropertiesChanged.
-	 * If we didn't see it, do a one-off Get to resync. */
-	if (!saw_status) {
-		int playing = 0;
-		
-		if (dbus_call_get_playbackstatus(m, sender, &playing) == 0)
-			player_set_playing(m, p, playing);
+		/* Some players don't include PlaybackStatus in PropertiesChanged
+		 * (or change it silently alongside Metadata); resync, debounced. */
+		if (props.status)
+			player_set_playing(m, p, streq(props.status, "Playing"));
+		else
+			player_schedule_resync(m, p);
 	}
 }
 
@@ -476,7 +1084,6 @@ handle_name_owner_changed(Mpris *m, DBusMessage *msg)
 {
 	Player *p;
 	const char *name = NULL, *old_owner = NULL, *new_owner = NULL;
-	int playing;
 
 	if (!dbus_message_get_args(msg, NULL,
 	                          DBUS_TYPE_STRING, &name,
@@ -491,91 +1098,97 @@ handle_name_owner_changed(Mpris *m, DBusMessage *msg)
 		return;
 
 	/* disappeared */
-	if (new_owner && *new_owner == '\0') {
+	if (!new_owner || *new_owner == '\0') {
 		player_remove(m, name);
 		return;
 	}
 
-	/* appeared: add and do a one-time Get for current status */
+	/* appeared or changed hands: add, remember owner, one-time async Get */
 	p = player_find(m, name);
 	if (!p)
 		p = player_add(m, name);
 	if (!p)
 		return;
 
-	playing = 0;
-	if (dbus_call_get_playbackstatus(m, name, &playing) == 0)
-		player_set_playing(m, p, playing);
+	player_set_owner(m, p, new_owner);
+	player_schedule_resync(m, p);
 }
 
-static size_t
-dispatch_all_messages(Mpris *m)
+static DBusHandlerResult
+mpris_filter(DBusConnection *conn, DBusMessage *msg, void *data)
 {
-	size_t n = 0;
-
-	for (;;) {
-		DBusMessage *msg = dbus_connection_pop_message(m->conn);
-
-		if (!msg)
-			break;
+	Mpris *m = (Mpris *)data;
 
-		n++;
+	(void)conn;
 
-		if (dbus_message_is_signal(msg, "org.freedesktop.DBus.Properties", "PropertiesChanged")) {
-			handle_properties_changed(m, msg);
-		} else if (dbus_message_is_signal(msg, "org.freedesktop.DBus", "NameOwnerChanged")) {
-			handle_name_owner_changed(m, msg);
-		}
+	m->nmsgs++;
 
-		dbus_message_unref(msg);
+	if (dbus_message_is_signal(msg, "org.freedesktop.DBus.Properties", "PropertiesChanged")) {
+		handle_properties_changed(m, msg);
+	} else if (dbus_message_is_signal(msg, "org.freedesktop.DBus", "NameOwnerChanged")) {
+		handle_name_owner_changed(m, msg);
 	}
 
-	return n;
+	/* Signals may interest other filters on the same connection */
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
 
-static int
-mpris_setup(Mpris *m, bool verbose)
+/*
+ * Run every queued message through libdbus: replies complete their
+ * pending calls, everything else goes through mpris_filter().
+ */
+static size_t
+dispatch_all_messages(Mpris *m)
 {
-	DBusError err;
+	const size_t n = m->nmsgs;
+
+	while (dbus_connection_dispatch(m->conn) == DBUS_DISPATCH_DATA_REMAINS)
+		;
 
-	m->verbose = verbose;
+	metrics_add(MET_DBUS_SIGNALS, m->nmsgs - n);
+	return m->nmsgs - n;
+}
 
-	dbus_error_init(&err);
+/* Install filter and matches on a fresh connection and start discovery. */
+static int
+mpris_connect(Mpris *m)
+{
+	m->conn = bus_conn(m->bus);
+	if (!m->conn)
+		return -1;
 
-	m->conn = dbus_bus_get(DBUS_BUS_SESSION, &err);
-	if (!m->conn) {
-		warn("[MPRIS] dbus_bus_get failed: %s", err.message ? err.message : "unknown error");
-		dbus_error_free(&err);
+	if (!dbus_connection_add_filter(m->conn, mpris_filter, m, NULL)) {
+		warn("[MPRIS] add_filter failed");
 		return -1;
 	}
 
-	/* Match MPRIS PropertiesChanged */
-	dbus_bus_add_match(m->conn,
-		"type='signal',interface='org.freedesktop.DBus.Properties',member='PropertiesChanged'",
-		&err);
-	if (dbus_error_is_set(&err)) {
-		warn("[MPRIS] add_match(PropertiesChanged) failed: %s", err.message);
-		dbus_error_free(&err);
+	/*
+	 * Matches are queued, not waited for: the bus handles them before
+	 * ListNames below, so no player can slip between the two.
+	 */
+
+	/* Match MPRIS PropertiesChanged (player interface only) */
+	if (bus_add_match(m->conn,
+		"type='signal',interface='org.freedesktop.DBus.Properties',member='PropertiesChanged',"
+		"path='/org/mpris/MediaPlayer2',arg0='org.mpris.MediaPlayer2.Player'",
+		"[MPRIS] add_match(PropertiesChanged)") < 0)
 		return -1;
-	}
 
 	/* Track MPRIS names appearing/disappearing */
-	dbus_bus_add_match(m->conn,
+	if (bus_add_match(m->conn,
 		"type='signal',interface='org.freedesktop.DBus',member='NameOwnerChanged',arg0namespace='org.mpris.MediaPlayer2'",
-		&err);
-	if (dbus_error_is_set(&err)) {
-		warn("[MPRIS] add_match(NameOwnerChanged) failed: %s", err.message);
-		dbus_error_free(&err);
+		"[MPRIS] add_match(NameOwnerChanged)") < 0)
 		return -1;
-	}
 
-	if (!dbus_connection_set_watch_functions(m->conn, watch_add, watch_remove, watch_toggle, m, NULL)) {
-		warn("[MPRIS] set_watch_functions failed");
-		return -1;
-	}
+	/* Serving ScreenSaver is best effort, MPRIS works without it */
+	if (screensaver_attach(m->ss, m->conn) < 0)
+		warn("[MPRIS] org.freedesktop.ScreenSaver not available");
 
-	/* Initial sync: discover existing players + fetch current status once */
-	initial_sync_players(m);
+	/* Existing players are found in the background, the loop runs meanwhile */
+	m->sync_start_ms = monotonic_ms();
+	players_discover(m);
+	if (!m->list_pending)
+		m->sync_start_ms = 0;
 
 	/* Drain any queued signals */
 	dbus_connection_read_write(m->conn, 0);
@@ -584,10 +1197,87 @@ mpris_setup(Mpris *m, bool verbose)
 	return 0;
 }
 
+static int
+mpris_setup(Mpris *m, const Options *opt)
+{
+	m->verbose = opt->verbose;
+	m->allow = &opt->player_allow;
+	m->deny = &opt->player_deny;
+	m->stale_ms = opt->stale_s * 1000UL;
+
+	if (!(m->ss = screensaver_init(opt->verbose)))
+		return -1;
+
+	if (!(m->bus = bus_open(DBUS_BUS_SESSION)))
+		return -1;
+
+	return mpris_connect(m);
+}
+
+/*
+ * Connection lost: forget everything tied to it (owners, pending calls)
+ * but keep the players and their cached status, so inhibit holds across
+ * a bus restart. Reconnecting is left to mpris_try_reconnect().
+ */
+static void
+mpris_lost(Mpris *m)
+{
+	const unsigned long long now_ms = monotonic_ms();
+
+	warn("[MPRIS] Lost DBus connection, reconnecting");
+
+	screensaver_detach(m->ss);
+	discovery_cancel(m);
+
+	for (Player *p = m->players; p; p = p->next) {
+		player_cancel_pending(p);
+		p->owner[0] = '\0';
+		p->resync_at_ms = 0;
+	}
+	m->resync_count = 0;
+	m->sample_at_ms = 0;
+
+	if (m->conn)
+		dbus_connection_remove_filter(m->conn, mpris_filter, m);
+	m->conn = NULL;
+
+	m->lost_at_ms = now_ms ? now_ms : 1;
+	m->retry_backoff_ms = MPRIS_RECONNECT_MIN_MS;
+	m->retry_at_ms = now_ms + m->retry_backoff_ms;
+}
+
+static void
+mpris_try_reconnect(Mpris *m, unsigned long long now_ms)
+{
+	if (now_ms < m->retry_at_ms)
+		return;
+
+	if (m->playing_count && now_ms - m->lost_at_ms >= MPRIS_RECONNECT_GRACE_MS) {
+		warn("[MPRIS] DBus still down, dropping cached playback state");
+		players_clear(m);
+	}
+
+	if (bus_reconnect(m->bus) == 0 && mpris_connect(m) == 0) {
+		verbose(m->verbose, "[MPRIS] reconnected after %llu ms", now_ms - m->lost_at_ms);
+		m->lost_at_ms = 0;
+		return;
+	}
+
+	screensaver_detach(m->ss);
+	if (m->conn)
+		dbus_connection_remove_filter(m->conn, mpris_filter, m);
+	m->conn = NULL;
+
+	m->retry_backoff_ms *= 2;
+	if (m->retry_backoff_ms > MPRIS_RECONNECT_MAX_MS)
+		m->retry_backoff_ms = MPRIS_RECONNECT_MAX_MS;
+	m->retry_at_ms = now_ms + m->retry_backoff_ms;
+}
+
 /* ------------------------------ MPRIS public ----------------------------- */
 
 Mpris *
-mpris_init(bool verbose)
+mpris_init(const Options *opt)
 {
 	Mpris *m;
 
@@ -598,21 +1288,12 @@ mpris_init(bool verbose)
 		return NULL;
 	}
 
-	if (mpris_setup(m, verbose) < 0) {
+	if (mpris_setup(m, opt) < 0) {
+		players_clear(m);
+		screensaver_cleanup(m->ss);
 		if (m->conn)
-			dbus_connection_unref(m->conn);
-
-		free(m->pfds);
-		free(m->watches);
-
-		while (m->players) {
-			Player *p = m->players;
-
-			m->players = p->next;
-			free(p->name);
-			free(p);
-		}
-
+			dbus_connection_remove_filter(m->conn, mpris_filter, m);
+		bus_close(m->bus);
 		free(m);
 		warn("[MPRIS] init failed, running without inhibit");
 		return NULL;
@@ -627,194 +1308,132 @@ mpris_cleanup(Mpris *m)
 	if (!m)
 		return;
 
-	free(m->pfds);
-	m->pfds = NULL;
-	m->pfds_cap = 0;
+	discovery_cancel(m);
+	players_clear(m);
+	screensaver_cleanup(m->ss);
+	m->ss = NULL;
 
-	while (m->players) {
-		Player *p = m->players;
-
-		m->players = p->next;
-		free(p->name);
-		free(p);
-	}
-
-	free(m->watches);
-	m->watches = NULL;
-	m->nwatches = m->cap_watches = 0;
-
-	if (m->conn) {
-		dbus_connection_unref(m->conn);
-		m->conn = NULL;
-	}
+	if (m->conn)
+		dbus_connection_remove_filter(m->conn, mpris_filter, m);
+	bus_close(m->bus);
+	m->bus = NULL;
+	m->conn = NULL;
 
 	free(m);
 }
 
-bool
-mpris_is_playing(const Mpris *m)
+unsigned int
+mpris_playing_count(const Mpris *m)
 {
-	if (!m)
-		return false;
-
-	return m->playing_count > 0;
-}
-
-static int
-mpris_check_connection(Mpris *m)
-{
-	if (!m || !m->conn)
-		return -1;
-
-	if (!dbus_connection_get_is_connected(m->conn))
-		return -1;
-
-	return 0;
+	return m ? m->playing_count : 0;
 }
 
-int
-mpris_poll(Mpris *m, unsigned int timeout_ms)
+unsigned int
+mpris_inhibit_mask(const Mpris *m)
 {
-	struct pollfd *pfds;
-	int pret;
-	size_t nfds;
-	size_t cap;
+	unsigned int mask = 0;
 
 	if (!m)
-		return -1;
-
-	if (mpris_check_connection(m) < 0)
-		return -1;
-
-	pfds = m->pfds;
-	nfds = 0;
-	cap  = m->pfds_cap;
-
-	/* ---------- build pollfd set (unique fds, OR'd events) ---------- */
-
-	for (size_t i = 0; i < m->nwatches; i++) {
-		DBusWatch *w;
-		size_t idx;
+		return 0;
 
-		w  = m->watches[i].watch;
-		if (!dbus_watch_get_enabled(w))
-			continue;
+	if (screensaver_is_inhibited(m->ss))
+		return INHIBIT_ALL;
 
-		const int   fd = m->watches[i].fd;
-		const short ev = dbus_flags_to_poll(dbus_watch_get_flags(w));
+	if (m->playing_count <= m->stale_count)
+		return 0;
 
-		idx = pfd_index(pfds, nfds, fd);
-		if (idx != (size_t)-1) {
-			pfds[idx].events |= ev;
+	for (const Player *p = m->players; p; p = p->next) {
+		if (!p->is_playing || p->stale)
 			continue;
-		}
+		if (p->media != MEDIA_AUDIO)
+			return INHIBIT_ALL;
+		mask = INHIBIT_AUDIO;
+	}
 
-		if (nfds == cap) {
-			size_t ncap = cap ? cap * 2 : 16;
-			struct pollfd *np = realloc(pfds, ncap * sizeof(*np));
+	return mask;
+}
 
-			if (!np) {
-				warn("[MPRIS] realloc failed for pollfd array:");
-				return -1;
-			}
+void
+mpris_publish_state(Mpris *m, bool active, unsigned long idle_ms)
+{
+	if (m)
+		screensaver_set_state(m->ss, active, idle_ms);
+}
 
-			pfds = np;
-			cap = ncap;
-			m->pfds = pfds;
-			m->pfds_cap = cap;
-		}
+/*
+ * Work after the bus fds were serviced: dispatch queued signals, run due
+ * resyncs and the stale check. Owner tracking and signals keep players
+ * current; a full resync only follows a reconnect.
+ */
+static void
+mpris_process(Mpris *m)
+{
+	(void)dispatch_all_messages(m);
 
-		pfds[nfds].fd = fd;
-		pfds[nfds].events = ev;
-		pfds[nfds].revents = 0;
-		nfds++;
+	const unsigned long long now_ms = monotonic_ms();
+	if (now_ms) {
+		run_due_resyncs(m, now_ms);
+		run_stale_check(m, now_ms);
 	}
+}
 
-	pret = poll(pfds, (nfds_t)nfds, (int)timeout_ms);
-	if (pret < 0) {
-		if (errno != EINTR) {
-			warn("[MPRIS] poll failed:");
-			return -1;
-		}
-		pret = 0; /* treat EINTR as "no events" */
+size_t
+mpris_pollfds(const Mpris *m, const struct pollfd **pfds)
+{
+	if (!m || !m->bus || m->lost_at_ms) {
+		*pfds = NULL;
+		return 0;
 	}
 
-	/* ---------- feed events back into DBus watches ---------- */
-
-	if (pret > 0) {
-		for (size_t i = 0; i < m->nwatches; i++) {
-			DBusWatch *w;
-			unsigned int masked;
-
-			w = m->watches[i].watch;
-			if (!dbus_watch_get_enabled(w))
-				continue;
-
-			const int fd = m->watches[i].fd;
-			const size_t idx = pfd_index(pfds, nfds, fd);
-			if (idx == (size_t)-1)
-				continue;
-
-			const short revents = pfds[idx].revents;
-			if (!revents)
-				continue;
+	return bus_pollfds(m->bus, pfds);
+}
 
-			const unsigned int wflags    = dbus_watch_get_flags(w);
-			const unsigned int all_flags = poll_revents_to_dbus(revents);
+int
+mpris_dispatch(Mpris *m, const struct pollfd *pfds, size_t n)
+{
+	if (!m)
+		return -1;
 
-			/*
-			 * Only deliver READABLE/WRITABLE if the watch asked for them.
-			 * Always deliver ERROR/HANGUP when present.
-			 */
-			masked = (all_flags & (DBUS_WATCH_ERROR | DBUS_WATCH_HANGUP)) |
-			         (all_flags & wflags);
+	if (m->lost_at_ms) {
+		mpris_try_reconnect(m, monotonic_ms());
+		return 0;
+	}
 
-			if (masked)
-				dbus_watch_handle(w, masked);
-		}
+	if (bus_handle(m->bus, pfds, n) < 0) {
+		mpris_lost(m);
+		return 0;
 	}
 
-	/* ---------- drain + dispatch ---------- */
+	mpris_process(m);
+	return 0;
+}
 
-	dbus_connection_read_write(m->conn, 0);
-	const size_t nmsg = dispatch_all_messages(m);
+int
+mpris_timeout_ms(const Mpris *m)
+{
+	unsigned long long now_ms;
+	long next;
+	int tmo;
 
-	/* ---------- starvation guard + optional fallback ---------- */
+	if (!m)
+		return -1;
 
-	const unsigned long long now_ms = monotonic_ms();
-	if (now_ms) {
-		if (m->last_activity_ms == 0)
-			m->last_activity_ms = now_ms;
-
-		if (pret > 0 || nmsg > 0) {
-			m->last_activity_ms = now_ms;
-		} else if (now_ms - m->last_activity_ms >= (unsigned long long)MPRIS_STARVATION_MS) {
-			initial_sync_players(m);
-			dbus_connection_read_write(m->conn, 0);
-			(void)dispatch_all_messages(m);
-			m->last_activity_ms = now_ms;
-		}
+	now_ms = monotonic_ms();
 
-#if MPRIS_FALLBACK_POLL_S > 0
-		if (m->last_fallback_ms == 0)
-			m->last_fallback_ms = now_ms;
+	if (m->lost_at_ms)
+		return m->retry_at_ms > now_ms ? (int)(m->retry_at_ms - now_ms) : 0;
 
-		if (now_ms - m->last_fallback_ms >=
-		    (unsigned long long)MPRIS_FALLBACK_POLL_S * 1000ULL) {
+	tmo = bus_timeout_ms(m->bus);
+	next = resync_next_ms(m, now_ms);
 
-			m->last_fallback_ms = now_ms;
+	if (next >= 0 && (tmo < 0 || next < (long)tmo))
+		tmo = (int)next;
 
-			for (Player *p = m->players; p; p = p->next) {
-				int playing = 0;
-				if (dbus_call_get_playbackstatus(m, p->name, &playing) == 0)
-					player_set_playing(m, p, playing);
-			}
-		}
-#endif
+	if (m->sample_at_ms) {
+		next = m->sample_at_ms > now_ms ? (long)(m->sample_at_ms - now_ms) : 0;
+		if (tmo < 0 || next < (long)tmo)
+			tmo = (int)next;
 	}
 
-	m->pfds = pfds;
-	m->pfds_cap = cap;
-
-	return 0;
+	return tmo;
 }
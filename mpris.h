@@ -3,32 +3,79 @@
 #ifndef XCOFFEEBREAK_MPRIS_H
 #define XCOFFEEBREAK_MPRIS_H
 
+#include <poll.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include "args.h"
+#include "state.h"
+
+/* Upper bound of tracked players, part of the handle; further ones are ignored */
+#define MPRIS_MAX_PLAYERS 64
 
 typedef struct Mpris Mpris;
 
 /*
  * Initalize an MPRIS/DBus monitor.
  *
- * verbose: enable logging.
+ * Uses opt->verbose, the player allow/deny lists (checked once per
+ * player when it appears) and stale_s. opt must outlive the handle.
+ * Players live in a table allocated with it, see MPRIS_MAX_PLAYERS.
  *
  * Returns an initialized structure on success,
  * NULL on failiure.
  */
-Mpris *mpris_init(bool verbose);
+Mpris *mpris_init(const Options *opt);
 
 /* Close and free an MPRIS handle (safe to call with NULL). */
 void mpris_cleanup(Mpris *m);
 
 /*
- * Poll DBus for MPRIS activity.
+ * Time until the next internal deadline (libdbus timeout, pending
+ * resync). External loops must not sleep past it.
+ *
+ * Returns ms (0 if already due), -1 if nothing is scheduled.
+ */
+int mpris_timeout_ms(const Mpris *m);
+
+/*
+ * For external event loops: the DBus fds to poll. The array is kept in
+ * sync by the watch callbacks and only changes inside mpris_dispatch();
+ * copy it into the loop's own pollfd set.
+ *
+ * Returns the number of entries.
+ */
+size_t mpris_pollfds(const Mpris *m, const struct pollfd **pfds);
+
+/*
+ * For external event loops: hand back the entries from mpris_pollfds()
+ * with revents filled in by poll() (n may be 0 on timeout), then
+ * dispatch pending signals.
+ *
+ * A lost DBus connection is re-established here with backoff; players
+ * and their cached status are kept meanwhile (for a bounded grace
+ * period), so a bus restart does not drop inhibit.
  *
- * Returns 0 on success, -1 if the DBus connection is lost (the handle
- * becomes unusable; caller should close it and continue without inhibit).
+ * Returns 0 on success, -1 on an invalid handle.
+ */
+int mpris_dispatch(Mpris *m, const struct pollfd *pfds, size_t n);
+
+/* Players reporting PlaybackStatus == "Playing", stale ones included. */
+unsigned int mpris_playing_count(const Mpris *m);
+
+/*
+ * Stages currently blocked, as INHIBIT_* bits: INHIBIT_AUDIO while
+ * every playing player's cached Metadata hints at audio, everything
+ * for any other playing player (video or unknown) and ScreenSaver
+ * cookies, 0 when idle. Players whose Position stopped advancing (with
+ * stale_s set) do not count. Computed from cached state only.
  */
-int mpris_poll(Mpris *m, unsigned int timeout_ms);
+unsigned int mpris_inhibit_mask(const Mpris *m);
 
-/* True if any tracked player is in PlaybackStatus == "Playing". */
-bool mpris_is_playing(const Mpris *m);
+/*
+ * Publish daemon state to org.freedesktop.ScreenSaver queries.
+ * active: locked or further; idle_ms: latest raw idle sample.
+ * Cheap enough to call every iteration, signals only go out on edges.
+ */
+void mpris_publish_state(Mpris *m, bool active, unsigned long idle_ms);
 
 #endif /* XCOFFEEBREAK_MPRIS_H */
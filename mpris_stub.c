@@ -0,0 +1,68 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * mpris.h for builds without media inhibit (make MPRIS=0): no handle is
+ * ever created and nothing inhibits, like a session without a bus.
+ */
+
+#include "mpris.h"
+#include "utils.h"
+
+Mpris *
+mpris_init(const Options *opt)
+{
+	verbose(opt->verbose, "[MPRIS] not built in (MPRIS=0), running without inhibit");
+	return NULL;
+}
+
+void
+mpris_cleanup(Mpris *m)
+{
+	(void)m;
+}
+
+int
+mpris_timeout_ms(const Mpris *m)
+{
+	(void)m;
+	return -1;
+}
+
+size_t
+mpris_pollfds(const Mpris *m, const struct pollfd **pfds)
+{
+	(void)m;
+	*pfds = NULL;
+	return 0;
+}
+
+int
+mpris_dispatch(Mpris *m, const struct pollfd *pfds, size_t n)
+{
+	(void)m;
+	(void)pfds;
+	(void)n;
+	return -1;
+}
+
+unsigned int
+mpris_playing_count(const Mpris *m)
+{
+	(void)m;
+	return 0;
+}
+
+unsigned int
+mpris_inhibit_mask(const Mpris *m)
+{
+	(void)m;
+	return 0;
+}
+
+void
+mpris_publish_state(Mpris *m, bool active, unsigned long idle_ms)
+{
+	(void)m;
+	(void)active;
+	(void)idle_ms;
+}
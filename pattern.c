@@ -0,0 +1,122 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pattern.h"
+#include "utils.h"
+
+#define MPRIS_PREFIX     "org.mpris.MediaPlayer2."
+#define MPRIS_PREFIX_LEN (sizeof(MPRIS_PREFIX) - 1)
+
+typedef enum {
+	PAT_EXACT,   /* no metacharacters */
+	PAT_PREFIX,  /* "text*" */
+	PAT_GLOB,    /* anything else, fnmatch() */
+} PatternKind;
+
+struct Pattern {
+	PatternKind kind;
+	size_t len;              /* strlen(text), prefix length for PAT_PREFIX */
+	char *text;
+	struct Pattern *next;
+};
+
+static const char *
+strip_prefix(const char *s)
+{
+	return strncmp(s, MPRIS_PREFIX, MPRIS_PREFIX_LEN) == 0 ? s + MPRIS_PREFIX_LEN : s;
+}
+
+static Pattern *
+pattern_compile(const char *s, size_t n)
+{
+	Pattern *p;
+	size_t meta;
+
+	p = ecalloc(1, sizeof(*p));
+	p->text = ecalloc(n + 1, 1);
+	memcpy(p->text, s, n);
+	p->len = n;
+
+	meta = strcspn(p->text, "*?[\\");
+	if (meta == n)
+		p->kind = PAT_EXACT;
+	else if (meta == n - 1 && p->text[meta] == '*') {
+		p->kind = PAT_PREFIX;
+		p->len = meta;
+	} else
+		p->kind = PAT_GLOB;
+
+	return p;
+}
+
+int
+patterns_add(PatternList *l, const char *spec)
+{
+	Pattern **tail;
+
+	for (tail = &l->head; *tail; tail = &(*tail)->next)
+		;
+
+	while (spec) {
+		const char *comma = strchr(spec, ',');
+		const char *s = strip_prefix(spec);
+		size_t n = comma ? (size_t)(comma - s) : strlen(s);
+
+		if (n == 0)
+			return -1;
+
+		*tail = pattern_compile(s, n);
+		tail = &(*tail)->next;
+		spec = comma ? comma + 1 : NULL;
+	}
+
+	return 0;
+}
+
+bool
+patterns_empty(const PatternList *l)
+{
+	return !l->head;
+}
+
+bool
+patterns_match(const PatternList *l, const char *s)
+{
+	const Pattern *p;
+
+	s = strip_prefix(s);
+
+	for (p = l->head; p; p = p->next) {
+		switch (p->kind) {
+		case PAT_EXACT:
+			if (streq(p->text, s))
+				return true;
+			break;
+		case PAT_PREFIX:
+			if (strncmp(p->text, s, p->len) == 0)
+				return true;
+			break;
+		case PAT_GLOB:
+			if (fnmatch(p->text, s, 0) == 0)
+				return true;
+			break;
+		}
+	}
+
+	return false;
+}
+
+void
+patterns_free(PatternList *l)
+{
+	while (l->head) {
+		Pattern *p = l->head;
+
+		l->head = p->next;
+		free(p->text);
+		free(p);
+	}
+}
@@ -0,0 +1,34 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef XCOFFEEBREAK_PATTERN_H
+#define XCOFFEEBREAK_PATTERN_H
+
+#include <stdbool.h>
+
+typedef struct Pattern Pattern;
+
+/* A compiled list of glob patterns; zero-initialize before use. */
+typedef struct {
+	Pattern *head;
+} PatternList;
+
+/*
+ * Compile a comma separated list of globs (fnmatch(3) syntax) and append
+ * them to l. A leading "org.mpris.MediaPlayer2." is stripped, so both
+ * "spotify" and the full bus name work. Plain names and "prefix*" forms
+ * are matched without fnmatch().
+ *
+ * Returns 0 on success, -1 on an empty pattern.
+ */
+int patterns_add(PatternList *l, const char *spec);
+
+/* True if no pattern was added. */
+bool patterns_empty(const PatternList *l);
+
+/* True if s matches any pattern (s with the same prefix stripping). */
+bool patterns_match(const PatternList *l, const char *s);
+
+/* Free all patterns and reset the list. */
+void patterns_free(PatternList *l);
+
+#endif /* XCOFFEEBREAK_PATTERN_H */
@@ -0,0 +1,499 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <dbus/dbus.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bus.h"
+#include "screensaver.h"
+#include "utils.h"
+
+#define SS_NAME       "org.freedesktop.ScreenSaver"
+#define SS_IFACE      "org.freedesktop.ScreenSaver"
+#define SS_PATH       "/org/freedesktop/ScreenSaver"
+#define SS_PATH_SHORT "/ScreenSaver"  /* still used by some clients */
+
+#define SS_SENDER_MAX 64  /* unique names are ":1.N", far shorter */
+#define SS_LABEL_MAX  64  /* application/reason, logging only */
+
+/* Cookies carry the slot in their low byte, see cookie_slot() */
+#if SCREENSAVER_MAX_INHIBITORS > 255
+#error "SCREENSAVER_MAX_INHIBITORS must fit in a byte"
+#endif
+
+static const char ss_introspect_xml[] =
+	DBUS_INTROSPECT_1_0_XML_DOCTYPE_DECL_NODE
+	"<node>\n"
+	"  <interface name=\"" SS_IFACE "\">\n"
+	"    <method name=\"Inhibit\">\n"
+	"      <arg name=\"application_name\" type=\"s\" direction=\"in\"/>\n"
+	"      <arg name=\"reason_for_inhibit\" type=\"s\" direction=\"in\"/>\n"
+	"      <arg name=\"cookie\" type=\"u\" direction=\"out\"/>\n"
+	"    </method>\n"
+	"    <method name=\"UnInhibit\">\n"
+	"      <arg name=\"cookie\" type=\"u\" direction=\"in\"/>\n"
+	"    </method>\n"
+	"    <method name=\"GetActive\">\n"
+	"      <arg type=\"b\" direction=\"out\"/>\n"
+	"    </method>\n"
+	"    <method name=\"GetActiveTime\">\n"
+	"      <arg name=\"seconds\" type=\"u\" direction=\"out\"/>\n"
+	"    </method>\n"
+	"    <method name=\"GetSessionIdleTime\">\n"
+	"      <arg name=\"seconds\" type=\"u\" direction=\"out\"/>\n"
+	"    </method>\n"
+	"    <signal name=\"ActiveChanged\">\n"
+	"      <arg name=\"new_value\" type=\"b\"/>\n"
+	"    </signal>\n"
+	"  </interface>\n"
+	"  <interface name=\"org.freedesktop.DBus.Introspectable\">\n"
+	"    <method name=\"Introspect\">\n"
+	"      <arg name=\"xml_data\" type=\"s\" direction=\"out\"/>\n"
+	"    </method>\n"
+	"  </interface>\n"
+	"</node>\n";
+
+typedef struct Inhibitor {
+	uint32_t cookie;             /* 0 = free slot */
+	char sender[SS_SENDER_MAX];  /* caller's unique name */
+	char app[SS_LABEL_MAX];
+	char reason[SS_LABEL_MAX];
+} Inhibitor;
+
+struct ScreenSaver {
+	DBusConnection *conn;        /* NULL while detached */
+	bool owned;                  /* we are the primary owner of SS_NAME */
+	DBusPendingCall *name_pending; /* RequestName in flight, owned still false */
+	bool verbose;
+
+	Inhibitor slots[SCREENSAVER_MAX_INHIBITORS];
+	unsigned char free_slots[SCREENSAVER_MAX_INHIBITORS]; /* stack */
+	unsigned int nfree;
+	unsigned int count;          /* cookies held */
+	uint32_t generation;         /* makes stale cookies never match */
+
+	/* state as published by the main loop, see screensaver_set_state() */
+	bool active;
+	unsigned long long active_since_ms;
+	unsigned long idle_ms;
+};
+
+/* ------------------------------ cookie table ----------------------------- */
+
+static void
+slots_reset(ScreenSaver *s)
+{
+	for (unsigned int i = 0; i < SCREENSAVER_MAX_INHIBITORS; i++) {
+		s->slots[i].cookie = 0;
+		s->free_slots[i] = (unsigned char)(SCREENSAVER_MAX_INHIBITORS - 1 - i);
+	}
+	s->nfree = SCREENSAVER_MAX_INHIBITORS;
+	s->count = 0;
+}
+
+/* Cookie layout: generation << 8 | (slot + 1); never 0. */
+static Inhibitor *
+cookie_slot(ScreenSaver *s, uint32_t cookie)
+{
+	unsigned int idx = (cookie & 0xffu);
+
+	if (idx == 0 || idx > SCREENSAVER_MAX_INHIBITORS)
+		return NULL;
+
+	if (s->slots[idx - 1].cookie != cookie)
+		return NULL;
+
+	return &s->slots[idx - 1];
+}
+
+static Inhibitor *
+inhibitor_add(ScreenSaver *s, const char *sender, const char *app, const char *reason)
+{
+	Inhibitor *in;
+	unsigned int idx;
+
+	if (!s->nfree || strlen(sender) >= SS_SENDER_MAX)
+		return NULL;
+
+	idx = s->free_slots[--s->nfree];
+	in = &s->slots[idx];
+
+	s->generation = (s->generation + 1) & 0xffffffu;
+	in->cookie = (s->generation << 8) | (idx + 1);
+	snprintf(in->sender, sizeof(in->sender), "%s", sender);
+	snprintf(in->app, sizeof(in->app), "%s", app);
+	snprintf(in->reason, sizeof(in->reason), "%s", reason);
+	s->count++;
+
+	verbose(s->verbose, "[SCREENSAVER] inhibit #%u by %s (%s: %s)",
+	        in->cookie, in->sender, in->app, in->reason);
+	return in;
+}
+
+static void
+inhibitor_release(ScreenSaver *s, Inhibitor *in, const char *why)
+{
+	verbose(s->verbose, "[SCREENSAVER] uninhibit #%u by %s (%s)",
+	        in->cookie, in->sender, why);
+
+	s->free_slots[s->nfree++] = (unsigned char)(in - s->slots);
+	in->cookie = 0;
+	s->count--;
+}
+
+/* ------------------------------ method calls ----------------------------- */
+
+static DBusHandlerResult
+reply_and_unref(DBusConnection *conn, DBusMessage *reply)
+{
+	if (!reply)
+		return DBUS_HANDLER_RESULT_NEED_MEMORY;
+
+	dbus_connection_send(conn, reply, NULL);
+	dbus_message_unref(reply);
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static DBusHandlerResult
+handle_inhibit(ScreenSaver *s, DBusConnection *conn, DBusMessage *msg)
+{
+	DBusMessage *reply;
+	Inhibitor *in;
+	const char *sender, *app = NULL, *reason = NULL;
+	dbus_uint32_t cookie;
+
+	if (!dbus_message_get_args(msg, NULL,
+	                           DBUS_TYPE_STRING, &app,
+	                           DBUS_TYPE_STRING, &reason,
+	                           DBUS_TYPE_INVALID))
+		return reply_and_unref(conn, dbus_message_new_error(msg,
+		       DBUS_ERROR_INVALID_ARGS, "expected (ss)"));
+
+	if (!(sender = dbus_message_get_sender(msg)))
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	if (!(in = inhibitor_add(s, sender, app, reason))) {
+		warn("[SCREENSAVER] refusing inhibit from %s: table full", sender);
+		return reply_and_unref(conn, dbus_message_new_error(msg,
+		       DBUS_ERROR_LIMITS_EXCEEDED, "too many inhibitors"));
+	}
+
+	cookie = in->cookie;
+	reply = dbus_message_new_method_return(msg);
+	if (reply && !dbus_message_append_args(reply, DBUS_TYPE_UINT32, &cookie, DBUS_TYPE_INVALID)) {
+		dbus_message_unref(reply);
+		reply = NULL;
+	}
+
+	return reply_and_unref(conn, reply);
+}
+
+static DBusHandlerResult
+handle_uninhibit(ScreenSaver *s, DBusConnection *conn, DBusMessage *msg)
+{
+	Inhibitor *in;
+	const char *sender;
+	dbus_uint32_t cookie = 0;
+
+	if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_UINT32, &cookie, DBUS_TYPE_INVALID))
+		return reply_and_unref(conn, dbus_message_new_error(msg,
+		       DBUS_ERROR_INVALID_ARGS, "expected (u)"));
+
+	sender = dbus_message_get_sender(msg);
+
+	/* Only the connection that took a cookie may return it */
+	in = cookie_slot(s, cookie);
+	if (in && sender && streq(in->sender, sender))
+		inhibitor_release(s, in, "released");
+
+	return reply_and_unref(conn, dbus_message_new_method_return(msg));
+}
+
+/* Reply with a single basic-typed value. */
+static DBusHandlerResult
+reply_basic(DBusConnection *conn, DBusMessage *msg, int type, const void *value)
+{
+	DBusMessage *reply = dbus_message_new_method_return(msg);
+
+	if (reply && !dbus_message_append_args(reply, type, value, DBUS_TYPE_INVALID)) {
+		dbus_message_unref(reply);
+		reply = NULL;
+	}
+
+	return reply_and_unref(conn, reply);
+}
+
+static unsigned long
+active_time_s(const ScreenSaver *s)
+{
+	unsigned long long now_ms;
+
+	if (!s->active)
+		return 0;
+
+	now_ms = monotonic_ms();
+	return now_ms > s->active_since_ms ? (unsigned long)((now_ms - s->active_since_ms) / 1000ULL) : 0;
+}
+
+static DBusHandlerResult
+ss_message(DBusConnection *conn, DBusMessage *msg, void *data)
+{
+	ScreenSaver *s = (ScreenSaver *)data;
+
+	/* Queries are answered from the cached state, no X round trip */
+	if (dbus_message_is_method_call(msg, SS_IFACE, "GetActive")) {
+		dbus_bool_t b = s->active;
+
+		return reply_basic(conn, msg, DBUS_TYPE_BOOLEAN, &b);
+	}
+
+	if (dbus_message_is_method_call(msg, SS_IFACE, "GetActiveTime")) {
+		dbus_uint32_t secs = (dbus_uint32_t)active_time_s(s);
+
+		return reply_basic(conn, msg, DBUS_TYPE_UINT32, &secs);
+	}
+
+	if (dbus_message_is_method_call(msg, SS_IFACE, "GetSessionIdleTime")) {
+		dbus_uint32_t secs = (dbus_uint32_t)(s->idle_ms / 1000UL);
+
+		return reply_basic(conn, msg, DBUS_TYPE_UINT32, &secs);
+	}
+
+	if (dbus_message_is_method_call(msg, SS_IFACE, "Inhibit"))
+		return handle_inhibit(s, conn, msg);
+
+	if (dbus_message_is_method_call(msg, SS_IFACE, "UnInhibit"))
+		return handle_uninhibit(s, conn, msg);
+
+	if (dbus_message_is_method_call(msg, DBUS_INTERFACE_INTROSPECTABLE, "Introspect")) {
+		const char *xml = ss_introspect_xml;
+
+		return reply_basic(conn, msg, DBUS_TYPE_STRING, &xml);
+	}
+
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+/* ------------------------------ name tracking ---------------------------- */
+
+/* Release every cookie of a client whose unique name left the bus. */
+static DBusHandlerResult
+ss_filter(DBusConnection *conn, DBusMessage *msg, void *data)
+{
+	ScreenSaver *s = (ScreenSaver *)data;
+	const char *name = NULL, *old_owner = NULL, *new_owner = NULL;
+
+	(void)conn;
+
+	if (!s->count || !dbus_message_is_signal(msg, DBUS_INTERFACE_DBUS, "NameOwnerChanged"))
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	/* Anyone may emit a signal with this name; only trust the bus */
+	if (!dbus_message_has_sender(msg, DBUS_SERVICE_DBUS))
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	if (!dbus_message_get_args(msg, NULL,
+	                           DBUS_TYPE_STRING, &name,
+	                           DBUS_TYPE_STRING, &old_owner,
+	                           DBUS_TYPE_STRING, &new_owner,
+	                           DBUS_TYPE_INVALID))
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	if (name[0] != ':' || *new_owner != '\0')
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	for (unsigned int i = 0; i < SCREENSAVER_MAX_INHIBITORS && s->count; i++)
+		if (s->slots[i].cookie && streq(s->slots[i].sender, name))
+			inhibitor_release(s, &s->slots[i], "client vanished");
+
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void
+name_notify(DBusPendingCall *pc, void *data)
+{
+	ScreenSaver *s = (ScreenSaver *)data;
+	DBusMessage *reply;
+	dbus_uint32_t ret;
+
+	reply = dbus_pending_call_steal_reply(pc);
+	dbus_pending_call_unref(pc);
+	s->name_pending = NULL;
+
+	if (!reply)
+		return;
+
+	if (!dbus_message_get_args(reply, NULL, DBUS_TYPE_UINT32, &ret, DBUS_TYPE_INVALID)) {
+		warn("[SCREENSAVER] request_name failed: %s",
+		     dbus_message_get_error_name(reply) ? dbus_message_get_error_name(reply) : "bad reply");
+	} else if (ret == DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+		s->owned = true;
+		verbose(s->verbose, "[SCREENSAVER] serving %s", SS_NAME);
+	} else {
+		verbose(s->verbose, "[SCREENSAVER] %s owned by another process, not serving", SS_NAME);
+	}
+
+	dbus_message_unref(reply);
+}
+
+/* Ask for SS_NAME; ownership is settled in name_notify(), not waited for. */
+static int
+name_request(ScreenSaver *s)
+{
+	DBusMessage *msg;
+	const char *name = SS_NAME;
+	dbus_uint32_t flags = DBUS_NAME_FLAG_DO_NOT_QUEUE;
+
+	msg = dbus_message_new_method_call(DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS,
+	                                   "RequestName");
+	if (!msg)
+		return -1;
+
+	if (!dbus_message_append_args(msg, DBUS_TYPE_STRING, &name, DBUS_TYPE_UINT32, &flags,
+	                              DBUS_TYPE_INVALID) ||
+	    !dbus_connection_send_with_reply(s->conn, msg, &s->name_pending, DBUS_TIMEOUT_USE_DEFAULT) ||
+	    !s->name_pending) {
+		dbus_message_unref(msg);
+		s->name_pending = NULL;
+		return -1;
+	}
+	dbus_message_unref(msg);
+
+	if (!dbus_pending_call_set_notify(s->name_pending, name_notify, s, NULL)) {
+		dbus_pending_call_cancel(s->name_pending);
+		dbus_pending_call_unref(s->name_pending);
+		s->name_pending = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* --------------------------- ScreenSaver public -------------------------- */
+
+ScreenSaver *
+screensaver_init(bool verbose)
+{
+	ScreenSaver *s;
+
+	s = calloc(1, sizeof(*s));
+	if (!s) {
+		warn("[SCREENSAVER] calloc failed");
+		return NULL;
+	}
+
+	s->verbose = verbose;
+	slots_reset(s);
+	return s;
+}
+
+void
+screensaver_cleanup(ScreenSaver *s)
+{
+	if (!s)
+		return;
+
+	screensaver_detach(s);
+	free(s);
+}
+
+int
+screensaver_attach(ScreenSaver *s, DBusConnection *conn)
+{
+	static const DBusObjectPathVTable vtable = { .message_function = ss_message };
+
+	if (!s || !conn)
+		return -1;
+
+	if (!dbus_connection_add_filter(conn, ss_filter, s, NULL))
+		goto oom;
+	if (!dbus_connection_register_object_path(conn, SS_PATH, &vtable, s)) {
+		dbus_connection_remove_filter(conn, ss_filter, s);
+		goto oom;
+	}
+	if (!dbus_connection_register_object_path(conn, SS_PATH_SHORT, &vtable, s)) {
+		dbus_connection_unregister_object_path(conn, SS_PATH);
+		dbus_connection_remove_filter(conn, ss_filter, s);
+		goto oom;
+	}
+
+	s->conn = conn;
+
+	/* Unique names leaving the bus (new owner ""), to expire cookies */
+	if (bus_add_match(conn,
+		"type='signal',sender='" DBUS_SERVICE_DBUS "',interface='" DBUS_INTERFACE_DBUS "',"
+		"member='NameOwnerChanged',arg2=''",
+		"[SCREENSAVER] add_match(NameOwnerChanged)") < 0 ||
+	    name_request(s) < 0) {
+		screensaver_detach(s);
+		goto oom;
+	}
+
+	return 0;
+
+oom:
+	warn("[SCREENSAVER] out of memory registering handlers");
+	return -1;
+}
+
+void
+screensaver_detach(ScreenSaver *s)
+{
+	if (!s || !s->conn)
+		return;
+
+	if (s->name_pending) {
+		dbus_pending_call_cancel(s->name_pending);
+		dbus_pending_call_unref(s->name_pending);
+		s->name_pending = NULL;
+	}
+
+	dbus_connection_remove_filter(s->conn, ss_filter, s);
+	dbus_connection_unregister_object_path(s->conn, SS_PATH);
+	dbus_connection_unregister_object_path(s->conn, SS_PATH_SHORT);
+
+	if (s->count)
+		verbose(s->verbose, "[SCREENSAVER] dropping %u inhibitor(s)", s->count);
+
+	slots_reset(s);
+	s->conn = NULL;
+	s->owned = false;
+}
+
+void
+screensaver_set_state(ScreenSaver *s, bool active, unsigned long idle_ms)
+{
+	DBusMessage *sig;
+	dbus_bool_t b = active;
+
+	if (!s)
+		return;
+
+	s->idle_ms = idle_ms;
+
+	if (active == s->active)
+		return;
+
+	s->active = active;
+	s->active_since_ms = active ? monotonic_ms() : 0;
+
+	if (!s->conn || !s->owned)
+		return;
+
+	verbose(s->verbose, "[SCREENSAVER] ActiveChanged(%s)", active ? "true" : "false");
+
+	sig = dbus_message_new_signal(SS_PATH, SS_IFACE, "ActiveChanged");
+	if (!sig)
+		return;
+
+	if (dbus_message_append_args(sig, DBUS_TYPE_BOOLEAN, &b, DBUS_TYPE_INVALID))
+		dbus_connection_send(s->conn, sig, NULL);
+	dbus_message_unref(sig);
+}
+
+bool
+screensaver_is_inhibited(const ScreenSaver *s)
+{
+	return s && s->count > 0;
+}
@@ -0,0 +1,50 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef XCOFFEEBREAK_SCREENSAVER_H
+#define XCOFFEEBREAK_SCREENSAVER_H
+
+#include <dbus/dbus.h>
+#include <stdbool.h>
+
+/* Upper bound of concurrent Inhibit() cookies; further calls are refused */
+#define SCREENSAVER_MAX_INHIBITORS 128
+
+typedef struct ScreenSaver ScreenSaver;
+
+/*
+ * Allocate the org.freedesktop.ScreenSaver service state (cookie table
+ * included, no allocation afterwards).
+ *
+ * Returns an initialized structure on success, NULL on failiure.
+ */
+ScreenSaver *screensaver_init(bool verbose);
+
+/* Detach and free (safe to call with NULL). */
+void screensaver_cleanup(ScreenSaver *s);
+
+/*
+ * Claim org.freedesktop.ScreenSaver on conn and serve its methods.
+ * The name is requested without waiting for the bus; if another
+ * process already owns it, the service stays idle.
+ *
+ * Returns 0 once the request is queued, -1 on failure.
+ */
+int screensaver_attach(ScreenSaver *s, DBusConnection *conn);
+
+/*
+ * Stop serving on the current connection and release every cookie
+ * (their owners went away with the bus).
+ */
+void screensaver_detach(ScreenSaver *s);
+
+/*
+ * Publish the daemon's state for GetActive/GetActiveTime/
+ * GetSessionIdleTime. active: screen locked or further; idle_ms: last
+ * raw X idle sample. ActiveChanged is emitted only when active flips.
+ */
+void screensaver_set_state(ScreenSaver *s, bool active, unsigned long idle_ms);
+
+/* True while at least one Inhibit() cookie is held. */
+bool screensaver_is_inhibited(const ScreenSaver *s);
+
+#endif /* XCOFFEEBREAK_SCREENSAVER_H */
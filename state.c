@@ -2,13 +2,20 @@
 
 #define _POSIX_C_SOURCE 200809L
 
+#include <signal.h>
+#include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "log.h"
 #include "state.h"
 #include "utils.h"
 
-static int run_cmd(const char *cmd);
+static pid_t run_cmd(const char *cmd);
+static bool locker_running(void);
+
+/* Last lock_cmd child, to avoid stacking lockers */
+static pid_t g_locker_pid = -1;
 
 void
 state_manager_init(StateManager *sm, unsigned long initial_idle_ms)
@@ -17,7 +24,8 @@ state_manager_init(StateManager *sm, unsigned long initial_idle_ms)
 	sm->baseline_idle_ms = initial_idle_ms;
 	sm->last_raw_idle_ms = initial_idle_ms;
 	sm->last_clock_ms = 0;
-	sm->last_playing = false;
+	sm->last_inhibit = 0;
+	sm->held = ST_ACTIVE;
 }
 
 void
@@ -26,15 +34,49 @@ state_manager_handle_resume(StateManager *sm, unsigned long raw_idle_ms, bool v)
 	sm->baseline_idle_ms = raw_idle_ms;
 	sm->last_raw_idle_ms = raw_idle_ms;
 
+	/* Re-prime suspend detection so the same resume is not seen twice */
+	sm->last_clock_ms = 0;
+
+	/* A locker started before sleep is still up */
+	if (sm->current != sm->held) {
+		verbose(v, "[STATE] %s -> %s (resume from suspend)", state_name(sm->current), state_name(sm->held));
+		sm->current = sm->held;
+	}
+}
+
+bool
+state_manager_lock(StateManager *sm, const Options *opt, const char *why)
+{
+	if (sm->held < ST_LOCKED)
+		sm->held = ST_LOCKED;
+
+	if (sm->current >= ST_LOCKED) {
+		verbose(opt->verbose, "[STATE] already %s (%s)", state_name(sm->current), why);
+		return false;
+	}
+
+	verbose(opt->verbose, "[STATE] locking (%s)", why);
+	state_transition(opt, sm->current, ST_LOCKED, state_manager_idle_ms(sm));
+	sm->current = ST_LOCKED;
+	return true;
+}
+
+void
+state_manager_unlock(StateManager *sm, unsigned long raw_idle_ms, bool v)
+{
+	sm->baseline_idle_ms = raw_idle_ms;
+	sm->last_raw_idle_ms = raw_idle_ms;
+	sm->held = ST_ACTIVE;
+
 	if (sm->current != ST_ACTIVE) {
-		verbose(v, "[STATE] %s -> %s (resume from suspend)", state_name(sm->current), state_name(ST_ACTIVE));
+		verbose(v, "[STATE] %s -> %s (unlocked)", state_name(sm->current), state_name(ST_ACTIVE));
 		sm->current = ST_ACTIVE;
 	}
 }
 
 State
 state_manager_update(StateManager *sm, const Options *opt,
-                     unsigned long raw_idle_ms, bool playing)
+                     unsigned long raw_idle_ms, unsigned int inhibit)
 {
 	State desired;
 	unsigned long eff_idle_ms, eff_idle_s;
@@ -54,29 +96,31 @@ state_manager_update(StateManager *sm, const Options *opt,
 	/* Detect user activity: idle time decreased beyond jitter threshold */
 	if (raw_idle_ms + X11_IDLE_JITTER_MS < sm->last_raw_idle_ms) {
 		sm->baseline_idle_ms = raw_idle_ms;
+		sm->held = ST_ACTIVE;
 		if (sm->current != ST_ACTIVE) {
-			verbose(opt->verbose, "[STATE] %s -> %s (user activity)",
-			        state_name(sm->current), state_name(ST_ACTIVE));
+			const LogFields fields = { state_name(ST_ACTIVE), NULL, (long)raw_idle_ms };
+
+			log_fields(opt->verbose, &fields, "[STATE] %s -> %s (user activity)",
+			           state_name(sm->current), state_name(ST_ACTIVE));
 			sm->current = ST_ACTIVE;
 		}
 	}
 	sm->last_raw_idle_ms = raw_idle_ms;
 
 	/* Handle inhibit state changes */
-	if (playing && !sm->last_playing) {
+	if (inhibit && !sm->last_inhibit) {
 		/* Inhibit started: reset baseline to prevent instant lock */
 		sm->baseline_idle_ms = raw_idle_ms;
-		sm->last_playing = playing;
-	} else if (!playing && sm->last_playing) {
+	} else if (!inhibit && sm->last_inhibit) {
 		/* Inhibit ended: reset baseline for fresh idle accumulation */
 		sm->baseline_idle_ms = raw_idle_ms;
-		sm->last_playing = playing;
-		verbose(opt->verbose, "[MPRIS] inhibit ended (reset baseline)");
+		verbose(opt->verbose, "[STATE] inhibit ended (reset baseline)");
+	} else if (inhibit != sm->last_inhibit) {
+		/* e.g. video -> music: newly allowed stages count from now */
+		sm->baseline_idle_ms = raw_idle_ms;
+		verbose(opt->verbose, "[STATE] inhibit changed (reset baseline)");
 	}
-
-	/* Don't update state while media is playing */
-	if (playing)
-		return sm->current;
+	sm->last_inhibit = inhibit;
 
 	/* Calculate effective idle time with overflow protection */
 	
@@ -89,6 +133,20 @@ state_manager_update(StateManager *sm, const Options *opt,
 
 	eff_idle_s = eff_idle_ms / 1000UL;
 	desired = state_desired(opt, eff_idle_s);
+	if (desired < sm->held)
+		desired = sm->held;
+
+	/*
+	 * While inhibited, hold the current state and only advance through
+	 * stages the mask leaves open (music may lock, not blank).
+	 */
+	if (inhibit) {
+		State st = sm->current;
+
+		while (st < desired && !(inhibit & INHIBIT_STAGE(st + 1)))
+			st++;
+		return st;
+	}
 
 	/* Backward transitions: just update state, no commands */
 	if (desired < sm->current)
@@ -126,6 +184,38 @@ state_manager_check_suspend(StateManager *sm)
 	return (delta_ms > SUSPEND_DETECT_MS);
 }
 
+unsigned long
+state_manager_idle_ms(const StateManager *sm)
+{
+	if (sm->last_raw_idle_ms < sm->baseline_idle_ms)
+		return 0;
+	return sm->last_raw_idle_ms - sm->baseline_idle_ms;
+}
+
+unsigned long
+state_threshold_ms(const Options *opt, State st)
+{
+	switch (st) {
+	case ST_LOCKED:    return opt->lock_s * 1000UL;
+	case ST_OFF:       return opt->off_s * 1000UL;
+	case ST_SUSPENDED: return opt->suspend_s * 1000UL;
+	default:           return 0;
+	}
+}
+
+long
+state_manager_ms_until(const StateManager *sm, const Options *opt, State st)
+{
+	unsigned long threshold_ms, idle_ms;
+
+	if (st <= sm->current || st > ST_SUSPENDED || (sm->last_inhibit & INHIBIT_STAGE(st)))
+		return -1;
+
+	threshold_ms = state_threshold_ms(opt, st);
+	idle_ms = state_manager_idle_ms(sm);
+	return idle_ms >= threshold_ms ? 0 : (long)(threshold_ms - idle_ms);
+}
+
 const char *
 state_name(State st)
 {
@@ -148,7 +238,7 @@ state_desired(const Options *opt, unsigned long idle_s)
 }
 
 void
-state_transition(const Options *opt, State from, State to)
+state_transition(const Options *opt, State from, State to, unsigned long idle_ms)
 {
 	/*
 	 * State transition behavior:
@@ -167,6 +257,7 @@ state_transition(const Options *opt, State from, State to)
 	 * - The baseline idle time is reset on user activity, so the timer
 	 *   effectively restarts from zero.
 	 */
+	LogFields fields = { NULL, NULL, (long)idle_ms };
 
 	/* Only execute actions when moving forward */
 	for (int st = (int)from + 1; st <= (int)to; st++) {
@@ -197,21 +288,50 @@ state_transition(const Options *opt, State from, State to)
 		if (!cmd)
 			continue;
 
-		verbose(opt->verbose, "[STATE] %s -> %s (%s)",
-		        state_name(from), state_name((State)st), what);
+		fields.state = state_name((State)st);
+		log_fields(opt->verbose, &fields, "[STATE] %s -> %s (%s)",
+		           state_name(from), state_name((State)st), what);
 
-		if (!opt->dry_run)
-			(void)run_cmd(cmd);
+		if ((State)st == ST_LOCKED && locker_running()) {
+			verbose(opt->verbose, "[STATE] locker %d still running, not starting another",
+			        (int)g_locker_pid);
+			from = (State)st;
+			continue;
+		}
+
+		if (!opt->dry_run) {
+			pid_t pid = run_cmd(cmd);
+			if ((State)st == ST_LOCKED)
+				g_locker_pid = pid;
+		}
 
 		from = (State)st;
 	}
 }
 
-static int
+/*
+ * Foreground lockers (slock, xsecurelock) live as long as the lock;
+ * forking ones exit right away and are caught by state dedupe instead.
+ * SIGCHLD is ignored, so an exited child is gone rather than a zombie.
+ */
+static bool
+locker_running(void)
+{
+	if (g_locker_pid <= 0)
+		return false;
+
+	if (kill(g_locker_pid, 0) == 0)
+		return true;
+
+	g_locker_pid = -1;
+	return false;
+}
+
+static pid_t
 run_cmd(const char *cmd)
 {
 	if (!cmd || !*cmd)
-		return 0;
+		return -1;
 
 	pid_t pid = fork();
 	if (pid < 0) {
@@ -223,5 +343,5 @@ run_cmd(const char *cmd)
 		_exit(127);
 	}
 
-	return 0;
+	return pid;
 }
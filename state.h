@@ -19,12 +19,23 @@ typedef enum {
 	ST_SUSPENDED,
 } State;
 
+/* Stages an inhibitor can block; an inhibit mask is an OR of these */
+#define INHIBIT_STAGE(st) (1u << (st))
+#define INHIBIT_LOCK      INHIBIT_STAGE(ST_LOCKED)
+#define INHIBIT_OFF       INHIBIT_STAGE(ST_OFF)
+#define INHIBIT_SUSPEND   INHIBIT_STAGE(ST_SUSPENDED)
+#define INHIBIT_ALL       (INHIBIT_LOCK | INHIBIT_OFF | INHIBIT_SUSPEND)
+
+/* Audio-only activity: locking is fine, blanking and suspend are not */
+#define INHIBIT_AUDIO     (INHIBIT_OFF | INHIBIT_SUSPEND)
+
 typedef struct {
 	State          current;
 	unsigned long  baseline_idle_ms;
 	unsigned long  last_raw_idle_ms;
 	unsigned long  last_clock_ms;
-	bool           last_playing;
+	unsigned int   last_inhibit;  /* INHIBIT_* mask of the previous update */
+	State          held;          /* externally requested floor, cleared on activity */
 } StateManager;
 
 /* Initialize state manager with current idle time */
@@ -33,20 +44,42 @@ void state_manager_init(StateManager *sm, unsigned long initial_idle_ms);
 /* Handle system resume from suspend - resets baseline and state */
 void state_manager_handle_resume(StateManager *sm, unsigned long raw_idle_ms, bool verbose);
 
-/* Update state based on idle time and media playback status
+/* Lock now, outside the idle timeline (e.g. before sleep). The state is
+ * held at LOCKED or above until user activity.
+ * Returns true if lock_cmd ran, false if already locked */
+bool state_manager_lock(StateManager *sm, const Options *opt, const char *why);
+
+/* Session unlocked from outside: back to ACTIVE, idle time restarts */
+void state_manager_unlock(StateManager *sm, unsigned long raw_idle_ms, bool verbose);
+
+/* Update state based on idle time and the inhibit mask (INHIBIT_*):
+ * blocked stages are not entered while the mask holds them
  * Returns the new desired state */
 State state_manager_update(StateManager *sm, const Options *opt,
-                           unsigned long raw_idle_ms, bool playing);
+                           unsigned long raw_idle_ms, unsigned int inhibit);
 
 /* Check if system suspended by detecting large clock jumps
  * Returns true if suspend detected */
 bool state_manager_check_suspend(StateManager *sm);
 
+/* Effective idle time of the last update (raw idle minus baseline) */
+unsigned long state_manager_idle_ms(const StateManager *sm);
+
+/* Effective idle time still needed to reach stage st, from the last update
+ * Returns ms (0 if due), -1 if st is reached already or blocked by inhibit */
+long state_manager_ms_until(const StateManager *sm, const Options *opt, State st);
+
+/* Effective idle time at which stage st is entered (0 for ST_ACTIVE) */
+unsigned long state_threshold_ms(const Options *opt, State st);
+
 /* Get name of state for logging */
 const char *state_name(State st);
 
-/* Execute state transition commands (only forward transitions) */
-void state_transition(const Options *opt, State from, State to);
+/*
+ * Execute state transition commands (only forward transitions).
+ * idle_ms is logged with each stage.
+ */
+void state_transition(const Options *opt, State from, State to, unsigned long idle_ms);
 
 /* Determine desired state based on idle time */
 State state_desired(const Options *opt, unsigned long idle_s);
@@ -0,0 +1,27 @@
+#!/bin/sh
+# See LICENSE file for copyright and license details.
+#
+# Behaviour checks: run each check binary given on the command line on
+# its own private dbus-daemon, handed to it as both the session and the
+# system bus. The real buses are never touched.
+#
+# Output: one "name: ok" or "name: FAIL" line per check. Any failure
+# makes the exit status 1.
+
+set -u
+
+command -v dbus-daemon >/dev/null 2>&1 || { echo "$0: dbus-daemon not found" >&2; exit 2; }
+[ $# -gt 0 ] || { echo "usage: $0 check ..." >&2; exit 2; }
+
+STATUS=0
+unset XDG_SESSION_ID
+
+for check in "$@"; do
+	bus=$(dbus-daemon --session --fork --print-address=1 --print-pid=1) || exit 2
+	# shellcheck disable=SC2086
+	set -- $bus
+	DBUS_SESSION_BUS_ADDRESS="$1" DBUS_SYSTEM_BUS_ADDRESS="$1" "$check" || STATUS=1
+	kill "$2" 2>/dev/null
+done
+
+exit $STATUS
@@ -0,0 +1,117 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Behaviour check for asound.c against a stand-in /proc/asound.
+ *
+ * A temporary tree with one card holding a playback and a capture
+ * substream is handed to asound_init(). Flipping the status files
+ * between "closed" and "state: RUNNING" must flip the inhibit mask,
+ * and a card appearing (root/pcm changing) must be picked up. Any
+ * mismatch makes the exit status 1.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../asound.h"
+#include "../state.h"
+#include "../utils.h"
+
+#define CLOSED  "closed\n"
+#define RUNNING "state: RUNNING\nowner_pid   : 1\n"
+
+static char root[PATH_MAX];
+static bool failed;
+
+/* Write content to root/rel, creating the directories on the way */
+static void
+put(const char *rel, const char *content)
+{
+	char path[PATH_MAX];
+	FILE *f;
+
+	if (snprintf(path, sizeof(path), "%s/%s", root, rel) >= (int)sizeof(path))
+		die("[CHECK] path too long: %s/%s", root, rel);
+
+	for (char *p = path + strlen(root) + 1; (p = strchr(p, '/')); p++) {
+		*p = '\0';
+		mkdir(path, 0700);
+		*p = '/';
+	}
+
+	if (!(f = fopen(path, "w")) || fputs(content, f) < 0 || fclose(f) != 0)
+		die("[CHECK] cannot write %s:", path);
+}
+
+static void
+expect(Asound *a, unsigned int want, const char *what)
+{
+	unsigned int got = asound_inhibit_mask(a);
+
+	if (got != want) {
+		warn("[CHECK] %s: mask 0x%x, expected 0x%x", what, got, want);
+		failed = true;
+	}
+}
+
+static int
+rm_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	(void)st; (void)flag; (void)ftw;
+	return remove(path);
+}
+
+int
+main(int argc, char *argv[])
+{
+	Asound *a, *play;
+	bool v = argc > 1 && streq(argv[1], "-v");
+	const char *tmp = getenv("TMPDIR");
+
+	snprintf(root, sizeof(root), "%s/xcoffeebreak-asound.XXXXXX", tmp && *tmp ? tmp : "/tmp");
+	if (!mkdtemp(root))
+		die("[CHECK] mkdtemp:");
+
+	put("pcm", "00-00: check : check : playback 1 : capture 1\n");
+	put("card0/pcm0p/sub0/status", CLOSED);
+	put("card0/pcm0c/sub0/status", CLOSED);
+
+	if (!(a = asound_init(root, true, v)) || !(play = asound_init(root, false, v)))
+		die("[CHECK] asound_init failed");
+
+	expect(a, 0, "all closed");
+
+	put("card0/pcm0p/sub0/status", RUNNING);
+	expect(a, INHIBIT_AUDIO, "playback running");
+
+	put("card0/pcm0c/sub0/status", RUNNING);
+	expect(a, INHIBIT_ALL, "capture running");
+	expect(play, INHIBIT_AUDIO, "capture running, capture not watched");
+
+	put("card0/pcm0p/sub0/status", CLOSED);
+	put("card0/pcm0c/sub0/status", CLOSED);
+	expect(a, 0, "closed again");
+
+	/* A new card is only walked once root/pcm lists it */
+	put("card1/pcm3p/sub1/status", RUNNING);
+	put("pcm", "00-00: check : check : playback 1 : capture 1\n"
+	           "01-03: check : check : playback 1\n");
+	expect(a, INHIBIT_AUDIO, "hotplugged card running");
+	expect(play, INHIBIT_AUDIO, "hotplugged card running, playback only");
+
+	put("card1/pcm3p/sub1/status", CLOSED);
+	expect(a, 0, "hotplugged card closed");
+
+	asound_cleanup(a);
+	asound_cleanup(play);
+	nftw(root, rm_entry, 8, FTW_DEPTH | FTW_PHYS);
+
+	printf("asound: %s\n", failed ? "FAIL" : "ok");
+	return failed;
+}
@@ -0,0 +1,120 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Behaviour check for camera.c against a stand-in /dev.
+ *
+ * Plain files named video* in a temporary directory play the video
+ * nodes: opening and closing them must flip the inhibit mask, for
+ * nodes present at camera_init() and ones created later alike, while
+ * other names are ignored. Any mismatch makes the exit status 1.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../camera.h"
+#include "../state.h"
+#include "../utils.h"
+
+#define SETTLE_MS 100  /* for inotify events that may not come */
+
+static char dir[PATH_MAX];
+static bool failed;
+
+static int
+node_open(const char *name, int flags)
+{
+	char path[PATH_MAX];
+	int fd = -1;
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path) ||
+	    (fd = open(path, flags | O_CLOEXEC, 0600)) < 0)
+		die("[CHECK] cannot open %s/%s:", dir, name);
+
+	return fd;
+}
+
+static void
+node_unlink(const char *name)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir, name) < (int)sizeof(path))
+		unlink(path);
+}
+
+/* Drain inotify the way the main loop does, then compare the mask */
+static void
+expect(Camera *c, unsigned int want, const char *what)
+{
+	struct pollfd p = { camera_fd(c), POLLIN, 0 };
+	unsigned int got;
+
+	while (poll(&p, 1, SETTLE_MS) > 0)
+		camera_dispatch(c);
+
+	if ((got = camera_inhibit_mask(c)) != want) {
+		warn("[CHECK] %s: mask 0x%x, expected 0x%x", what, got, want);
+		failed = true;
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	Camera *c;
+	bool v = argc > 1 && streq(argv[1], "-v");
+	const char *tmp = getenv("TMPDIR");
+	int fd, fd2;
+
+	snprintf(dir, sizeof(dir), "%s/xcoffeebreak-camera.XXXXXX", tmp && *tmp ? tmp : "/tmp");
+	if (!mkdtemp(dir))
+		die("[CHECK] mkdtemp:");
+
+	close(node_open("video0", O_RDONLY | O_CREAT));
+	close(node_open("audio0", O_RDONLY | O_CREAT));
+
+	if (!(c = camera_init(dir, v)))
+		die("[CHECK] camera_init failed");
+
+	expect(c, 0, "nothing open");
+
+	fd = node_open("video0", O_RDONLY);
+	expect(c, INHIBIT_ALL, "video0 open");
+
+	/* Opens are counted, one close of two keeps it busy */
+	fd2 = node_open("video0", O_RDWR);
+	close(fd);
+	expect(c, INHIBIT_ALL, "video0 open twice, closed once");
+	close(fd2);
+	expect(c, 0, "video0 closed");
+
+	fd = node_open("audio0", O_RDONLY);
+	expect(c, 0, "audio0 open");
+	close(fd);
+
+	/* A node created after init is watched from then on */
+	close(node_open("video1", O_RDONLY | O_CREAT));
+	expect(c, 0, "video1 created");
+	fd = node_open("video1", O_RDONLY);
+	expect(c, INHIBIT_ALL, "video1 open");
+
+	/* Unplugged while open */
+	node_unlink("video1");
+	close(fd);
+	expect(c, 0, "video1 removed");
+
+	camera_cleanup(c);
+	node_unlink("video0");
+	node_unlink("audio0");
+	rmdir(dir);
+
+	printf("camera: %s\n", failed ? "FAIL" : "ok");
+	return failed;
+}
@@ -0,0 +1,367 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Allocation guard check: run the daemon's main loop, minus X, with the
+ * guard armed after init, while every source sees traffic.
+ *
+ * Linked with the ALLOC_GUARD wraps (see the Makefile), so a malloc(),
+ * calloc(), realloc() or strdup() from our objects once armed aborts,
+ * which fails the check. Idle time comes from the clock instead of X.
+ * Run on a private bus given as DBUS_SESSION_BUS_ADDRESS and
+ * DBUS_SYSTEM_BUS_ADDRESS (tests/check.sh starts one); mpris_player
+ * is expected next to this binary. While the loop runs:
+ *
+ *   - MPRIS players flip Playing/Paused, one more appears and one leaves
+ *   - a client takes and drops a ScreenSaver inhibit
+ *   - logind's session lookup fails (there is none on the private bus)
+ *   - a stand-in /proc/asound substream runs and a card is hotplugged
+ *   - a stand-in video node is opened, closed, and another one created
+ *   - a control client pauses, asks for status and resumes
+ *
+ * Each source must also have shown up in the inhibit mask, or the check
+ * would pass without exercising anything.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <dbus/dbus.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../alloc.h"
+#include "../asound.h"
+#include "../camera.h"
+#include "../ctl.h"
+#include "../logind.h"
+#include "../mpris.h"
+#include "../state.h"
+#include "../utils.h"
+
+#define CHECK_RUN_MS  3000  /* armed main loop */
+#define PLAYER_FLIP   "250" /* ms between Playing and Paused */
+#define MAX_POLLFDS   64
+
+#define SEEN_PLAYER  (1u << 0)
+#define SEEN_SS      (1u << 1)
+#define SEEN_ASOUND  (1u << 2)
+#define SEEN_CAMERA  (1u << 3)
+#define SEEN_CTL     (1u << 4)
+#define SEEN_ALL     (SEEN_PLAYER | SEEN_SS | SEEN_ASOUND | SEEN_CAMERA | SEEN_CTL)
+
+static char tmp[80];  /* short enough for the control socket's sun_path */
+static char player[PATH_MAX];
+
+/* The guard's abort(): report like any other failed check */
+static void
+on_abort(int sig)
+{
+	static const char msg[] = "guard: FAIL\n";
+	ssize_t n;
+
+	(void)sig;
+	n = write(STDOUT_FILENO, msg, sizeof(msg) - 1);
+	_exit(n < 0 ? 2 : 1);
+}
+
+/* ------------------------------ stand-ins -------------------------------- */
+
+/* Write content to tmp/rel with plain syscalls, creating directories */
+static void
+put(const char *rel, const char *content)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	if (snprintf(path, sizeof(path), "%s/%s", tmp, rel) >= (int)sizeof(path))
+		die("[CHECK] path too long: %s/%s", tmp, rel);
+
+	for (char *p = path + strlen(tmp) + 1; (p = strchr(p, '/')); p++) {
+		*p = '\0';
+		mkdir(path, 0700);
+		*p = '/';
+	}
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0 ||
+	    write(fd, content, strlen(content)) != (ssize_t)strlen(content))
+		die("[CHECK] cannot write %s:", path);
+	close(fd);
+}
+
+static int
+node_open(const char *rel)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/%s", tmp, rel) >= (int)sizeof(path))
+		return -1;
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static pid_t
+player_start(const char *name)
+{
+	pid_t pid;
+	int null;
+
+	if ((pid = fork()) != 0)
+		return pid;
+
+	if ((null = open("/dev/null", O_WRONLY)) >= 0)
+		dup2(null, STDOUT_FILENO);
+	execl(player, player, name, PLAYER_FLIP, (char *)NULL);
+	_exit(127);
+}
+
+/* Inhibit, hold for a while, UnInhibit; exits 0 if both went through */
+static pid_t
+ss_client_start(void)
+{
+	DBusConnection *conn;
+	DBusMessage *msg, *reply;
+	const char *app = "check_guard", *why = "check";
+	dbus_uint32_t cookie;
+	struct timespec hold = { 0, 300 * 1000000L };
+	pid_t pid;
+	bool ok;
+
+	if ((pid = fork()) != 0)
+		return pid;
+
+	if (!(conn = dbus_bus_get_private(DBUS_BUS_SESSION, NULL)))
+		_exit(1);
+
+	msg = dbus_message_new_method_call("org.freedesktop.ScreenSaver", "/org/freedesktop/ScreenSaver",
+	                                   "org.freedesktop.ScreenSaver", "Inhibit");
+	dbus_message_append_args(msg, DBUS_TYPE_STRING, &app, DBUS_TYPE_STRING, &why, DBUS_TYPE_INVALID);
+	reply = dbus_connection_send_with_reply_and_block(conn, msg, 2000, NULL);
+	dbus_message_unref(msg);
+	if (!reply || !dbus_message_get_args(reply, NULL, DBUS_TYPE_UINT32, &cookie, DBUS_TYPE_INVALID))
+		_exit(1);
+	dbus_message_unref(reply);
+
+	nanosleep(&hold, NULL);
+
+	msg = dbus_message_new_method_call("org.freedesktop.ScreenSaver", "/org/freedesktop/ScreenSaver",
+	                                   "org.freedesktop.ScreenSaver", "UnInhibit");
+	dbus_message_append_args(msg, DBUS_TYPE_UINT32, &cookie, DBUS_TYPE_INVALID);
+	reply = dbus_connection_send_with_reply_and_block(conn, msg, 2000, NULL);
+	dbus_message_unref(msg);
+	ok = reply && dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_METHOD_RETURN;
+	_exit(ok ? 0 : 1);
+}
+
+/* Send a few requests on a fresh control connection, replies read later */
+static int
+ctl_client_start(void)
+{
+	static const char req[] = "pause 60\nstatus\n";
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	int fd;
+
+	snprintf(sa.sun_path, sizeof(sa.sun_path), "%s/%s", tmp, CTL_SOCKET);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0 ||
+	    connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+	    write(fd, req, sizeof(req) - 1) != (ssize_t)(sizeof(req) - 1))
+		die("[CHECK] control socket:");
+
+	return fd;
+}
+
+static int
+rm_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	(void)st; (void)flag; (void)ftw;
+	return remove(path);
+}
+
+/* ------------------------------ daemon side ------------------------------ */
+
+/* poll_wait() without X: one poll over every source, then dispatch */
+static void
+turn(Mpris *m, Logind *l, Camera *c, Ctl *ctl)
+{
+	struct pollfd pfds[MAX_POLLFDS];
+	const struct pollfd *src;
+	size_t nm, nl, nk;
+	int ready, tmo, wait = 20;
+
+	nm = mpris_pollfds(m, &src);
+	memcpy(pfds, src, nm * sizeof(*pfds));
+	nl = logind_pollfds(l, &src);
+	memcpy(pfds + nm, src, nl * sizeof(*pfds));
+	pfds[nm + nl] = (struct pollfd){ camera_fd(c), POLLIN, 0 };
+	nk = ctl_pollfds(ctl, &src);
+	memcpy(pfds + nm + nl + 1, src, nk * sizeof(*pfds));
+
+	if ((tmo = mpris_timeout_ms(m)) >= 0 && tmo < wait)
+		wait = tmo;
+	if ((tmo = logind_timeout_ms(l)) >= 0 && tmo < wait)
+		wait = tmo;
+
+	ready = poll(pfds, nm + nl + 1 + nk, wait);
+
+	(void)mpris_dispatch(m, pfds, ready > 0 ? nm : 0);
+	(void)logind_dispatch(l, pfds + nm, ready > 0 ? nl : 0);
+	if (ready > 0 && pfds[nm + nl].revents)
+		camera_dispatch(c);
+	ctl_dispatch(ctl, pfds + nm + nl + 1, ready > 0 ? nk : 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	Options opt = { .lock_s = 1, .off_s = 2, .poll_ms = 20, .dry_run = true };
+	StateManager sm;
+	Mpris *m = NULL;
+	Logind *l = NULL;
+	Asound *a = NULL;
+	Camera *c = NULL;
+	Ctl *ctl = NULL;
+	pid_t player_a, player_b = -1, ss = -1;
+	unsigned long long start_ms, t;
+	unsigned int seen = 0, step = 0;
+	int ctl_fd = -1, node = -1, status;
+	const char *dir = getenv("TMPDIR");
+	char root[PATH_MAX], devdir[PATH_MAX], reply[256];
+	const char *slash;
+
+	opt.verbose = argc > 1 && streq(argv[1], "-v");
+
+	/* mpris_player sits next to us in $(BINDIR) */
+	slash = strrchr(argv[0], '/');
+	snprintf(player, sizeof(player), "%.*smpris_player",
+	         slash ? (int)(slash - argv[0] + 1) : 0, argv[0]);
+
+	if (snprintf(tmp, sizeof(tmp), "%s/xcoffeebreak-guard.XXXXXX",
+	             dir && *dir ? dir : "/tmp") >= (int)sizeof(tmp) || !mkdtemp(tmp))
+		die("[CHECK] mkdtemp:");
+
+	put("asound/pcm", "00-00: check : check : playback 1\n");
+	put("asound/card0/pcm0p/sub0/status", "closed\n");
+	put("dev/video0", "");
+	setenv("XDG_RUNTIME_DIR", tmp, 1);
+	signal(SIGABRT, on_abort);
+
+	player_a = player_start("org.mpris.MediaPlayer2.check_a");
+
+	/* What init() in xcoffeebreak.c sets up */
+	snprintf(root, sizeof(root), "%s/asound", tmp);
+	snprintf(devdir, sizeof(devdir), "%s/dev", tmp);
+
+	state_manager_init(&sm, 0);
+	if (!(m = mpris_init(&opt)) || !(l = logind_init(opt.verbose, true)) ||
+	    !(a = asound_init(root, false, opt.verbose)) ||
+	    !(c = camera_init(devdir, opt.verbose)) || !(ctl = ctl_init(opt.verbose)))
+		die("[CHECK] init failed");
+
+	alloc_guard_arm();
+	start_ms = monotonic_ms();
+
+	while ((t = monotonic_ms() - start_ms) < CHECK_RUN_MS) {
+		unsigned int mask;
+		State st;
+
+		turn(m, l, c, ctl);
+
+		/* Traffic, one step at a time */
+		switch (step) {
+		case 0: if (t < 500) break;
+			player_b = player_start("org.mpris.MediaPlayer2.check_b");
+			step++; break;
+		case 1: if (t < 700) break;
+			put("asound/card0/pcm0p/sub0/status", "state: RUNNING\n");
+			node = node_open("dev/video0");
+			step++; break;
+		case 2: if (t < 900) break;
+			put("asound/card0/pcm0p/sub0/status", "closed\n");
+			put("asound/card1/pcm0p/sub0/status", "state: RUNNING\n");
+			put("asound/pcm", "00-00: check : check : playback 1\n"
+			                  "01-00: check : check : playback 1\n");
+			close(node);
+			put("dev/video1", "");
+			step++; break;
+		case 3: if (t < 1100) break;
+			put("asound/card1/pcm0p/sub0/status", "closed\n");
+			node = node_open("dev/video1");
+			step++; break;
+		case 4: if (t < 1300) break;
+			close(node);
+			kill(player_a, SIGTERM);
+			ss = ss_client_start();
+			step++; break;
+		case 5: if (t < 1800) break;
+			ctl_fd = ctl_client_start();
+			step++; break;
+		case 6: if (t < 2200) break;
+			memset(reply, 0, sizeof(reply));
+			if (read(ctl_fd, reply, sizeof(reply) - 1) > 0 && strstr(reply, "state=") &&
+			    ctl_inhibit_mask(ctl))
+				seen |= SEEN_CTL;
+			if (write(ctl_fd, "resume\n", 7) != 7)
+				warn("[CHECK] resume not sent");
+			step++; break;
+		}
+
+		/* The main loop body, minus logind events and X */
+		if (ctl_events(ctl) & CTL_EV_LOCK)
+			(void)state_manager_lock(&sm, &opt, "ctl lock");
+
+		mask = mpris_inhibit_mask(m) | asound_inhibit_mask(a) |
+		       camera_inhibit_mask(c) | ctl_inhibit_mask(ctl);
+
+		if (mpris_playing_count(m))
+			seen |= SEEN_PLAYER;
+		if (asound_inhibit_mask(a))
+			seen |= SEEN_ASOUND;
+		if (camera_inhibit_mask(c))
+			seen |= SEEN_CAMERA;
+
+		st = state_manager_update(&sm, &opt, (unsigned long)t, mask);
+		if (st > sm.current) {
+			state_transition(&opt, sm.current, st, state_manager_idle_ms(&sm));
+			sm.current = st;
+		}
+
+		mpris_publish_state(m, sm.current >= ST_LOCKED, (unsigned long)t);
+		logind_set_idle(l, sm.current != ST_ACTIVE);
+		ctl_publish(ctl, &sm, &opt);
+	}
+
+	if (ss > 0 && waitpid(ss, &status, 0) == ss && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		seen |= SEEN_SS;
+
+	kill(player_a, SIGTERM);
+	kill(player_b, SIGTERM);
+	while (wait(NULL) > 0)
+		;
+
+	if (ctl_fd >= 0)
+		close(ctl_fd);
+	ctl_cleanup(ctl);
+	camera_cleanup(c);
+	asound_cleanup(a);
+	logind_cleanup(l);
+	mpris_cleanup(m);
+	nftw(tmp, rm_entry, 8, FTW_DEPTH | FTW_PHYS);
+
+	if (seen != SEEN_ALL) {
+		warn("[CHECK] sources never seen: 0x%x", SEEN_ALL & ~seen);
+		printf("guard: FAIL\n");
+		return 1;
+	}
+
+	printf("guard: ok\n");
+	return 0;
+}
@@ -0,0 +1,459 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Behaviour check for logind.c against a stand-in logind.
+ *
+ * Run on a private bus given as DBUS_SYSTEM_BUS_ADDRESS (tests/check.sh
+ * starts one). A forked child owns org.freedesktop.login1 and plays
+ * logind's part of a suspend:
+ *
+ *   SetIdleHint(true) with the delay inhibitor held -> PrepareForSleep(true)
+ *   inhibitor fd closed                             -> PrepareForSleep(false)
+ *   inhibitor taken again, SetIdleHint(false)       -> Session.Lock
+ *   SetIdleHint(true)                               -> forged signals, Lock
+ *   SetIdleHint(false)                              -> Session.Unlock, done
+ *
+ * The forged signals come from a second connection that does not own
+ * the name and are addressed to the daemon directly, which bypasses its
+ * match rules: Unlock, PrepareForSleep(true) and a NameOwnerChanged
+ * handing it logind's name. None of them may show up as an event.
+ *
+ * The parent drives a Logind the way the main loop does. Either side
+ * failing or timing out makes the exit status 1.
+ */
+
+#include <dbus/dbus.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../logind.h"
+#include "../utils.h"
+
+#define FAKE_NAME     "org.freedesktop.login1"
+#define FAKE_PATH     "/org/freedesktop/login1"
+#define FAKE_MANAGER  "org.freedesktop.login1.Manager"
+#define FAKE_SESSION  "/org/freedesktop/login1/session/check"
+#define FAKE_SESSION_IFACE "org.freedesktop.login1.Session"
+#define CHECK_WAIT_MS 5000  /* for the whole exchange */
+#define MAX_POLLFDS   8
+
+enum {
+	FAKE_IDLE,      /* waiting for SetIdleHint(true) and the inhibitor */
+	FAKE_SLEEPING,  /* PrepareForSleep(true) sent, inhibitor must close */
+	FAKE_RESUMED,   /* PrepareForSleep(false) sent, inhibitor comes back */
+	FAKE_LOCKED,    /* Lock sent, SetIdleHint(true) acknowledges it */
+	FAKE_FORGED,    /* forged signals and Lock sent, SetIdleHint(false) next */
+	FAKE_DONE,      /* Unlock sent */
+};
+
+typedef struct {
+	DBusConnection *conn;
+	DBusConnection *forger;  /* same bus, does not own FAKE_NAME */
+	char peer[DBUS_MAXIMUM_NAME_LENGTH + 1]; /* the daemon's unique name */
+	int phase;
+	bool idle_hint;
+	int inhibitor;       /* our end of the last inhibitor pipe, -1 if none */
+	unsigned int inhibits;
+	bool failed;
+} Fake;
+
+/* ------------------------------ stand-in logind --------------------------- */
+
+static void
+fake_fail(Fake *f, const char *what)
+{
+	warn("[FAKE] %s", what);
+	f->failed = true;
+}
+
+/* Send sig (consumed) on conn, to dest only if given */
+static void
+fake_send(Fake *f, DBusConnection *conn, DBusMessage *sig, const char *dest)
+{
+	if (!sig || (dest && !dbus_message_set_destination(sig, dest)) ||
+	    !dbus_connection_send(conn, sig, NULL))
+		fake_fail(f, "cannot emit signal");
+
+	if (sig)
+		dbus_message_unref(sig);
+	dbus_connection_flush(conn);
+}
+
+static DBusMessage *
+fake_prepare_for_sleep(bool start)
+{
+	DBusMessage *sig;
+	dbus_bool_t b = start;
+
+	sig = dbus_message_new_signal(FAKE_PATH, FAKE_MANAGER, "PrepareForSleep");
+	if (sig && !dbus_message_append_args(sig, DBUS_TYPE_BOOLEAN, &b, DBUS_TYPE_INVALID)) {
+		dbus_message_unref(sig);
+		return NULL;
+	}
+
+	return sig;
+}
+
+static DBusMessage *
+fake_session_signal(const char *member)
+{
+	return dbus_message_new_signal(FAKE_SESSION, FAKE_SESSION_IFACE, member);
+}
+
+/* The bus daemon announcing that the forger took over FAKE_NAME */
+static DBusMessage *
+fake_owner_changed(Fake *f)
+{
+	DBusMessage *sig;
+	const char *name = FAKE_NAME, *old = "", *new = dbus_bus_get_unique_name(f->forger);
+
+	sig = dbus_message_new_signal(DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "NameOwnerChanged");
+	if (sig && !dbus_message_append_args(sig,
+	                                     DBUS_TYPE_STRING, &name,
+	                                     DBUS_TYPE_STRING, &old,
+	                                     DBUS_TYPE_STRING, &new,
+	                                     DBUS_TYPE_INVALID)) {
+		dbus_message_unref(sig);
+		return NULL;
+	}
+
+	return sig;
+}
+
+/*
+ * Forged signals straight at the daemon, then the real Lock. The round
+ * trip makes the bus route the forged ones first.
+ */
+static void
+fake_forge(Fake *f)
+{
+	DBusMessage *msg, *reply;
+
+	fake_send(f, f->forger, fake_session_signal("Unlock"), f->peer);
+	fake_send(f, f->forger, fake_prepare_for_sleep(true), f->peer);
+	fake_send(f, f->forger, fake_owner_changed(f), f->peer);
+
+	msg = dbus_message_new_method_call(DBUS_SERVICE_DBUS, DBUS_PATH_DBUS,
+	                                   DBUS_INTERFACE_DBUS, "GetId");
+	reply = msg ? dbus_connection_send_with_reply_and_block(f->forger, msg, CHECK_WAIT_MS, NULL)
+	            : NULL;
+	if (!reply)
+		fake_fail(f, "forger round trip failed");
+
+	if (msg)
+		dbus_message_unref(msg);
+	if (reply)
+		dbus_message_unref(reply);
+
+	fake_send(f, f->conn, fake_session_signal("Lock"), NULL);
+}
+
+/* Hand out the write end of a pipe, logind keeps the other one */
+static bool
+fake_inhibit(Fake *f, DBusMessage *call, DBusMessage *reply)
+{
+	const char *what, *who, *why, *mode;
+	int p[2];
+	bool ok;
+
+	if (!dbus_message_get_args(call, NULL,
+	                           DBUS_TYPE_STRING, &what, DBUS_TYPE_STRING, &who,
+	                           DBUS_TYPE_STRING, &why, DBUS_TYPE_STRING, &mode,
+	                           DBUS_TYPE_INVALID) ||
+	    !streq(what, "sleep") || !streq(mode, "delay")) {
+		fake_fail(f, "Inhibit is not a sleep delay lock");
+		return false;
+	}
+
+	if (f->inhibitor >= 0) {
+		fake_fail(f, "Inhibit while the previous lock is held");
+		return false;
+	}
+
+	if (pipe(p) < 0) {
+		fake_fail(f, "pipe failed");
+		return false;
+	}
+
+	ok = dbus_message_append_args(reply, DBUS_TYPE_UNIX_FD, &p[1], DBUS_TYPE_INVALID);
+	close(p[1]);
+	f->inhibitor = p[0];
+	f->inhibits++;
+	return ok;
+}
+
+static DBusHandlerResult
+fake_filter(DBusConnection *conn, DBusMessage *msg, void *data)
+{
+	Fake *f = (Fake *)data;
+	DBusMessage *reply;
+	const char *path = FAKE_SESSION;
+	dbus_bool_t b;
+
+	if (dbus_message_get_type(msg) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	if (!(reply = dbus_message_new_method_return(msg)))
+		return DBUS_HANDLER_RESULT_NEED_MEMORY;
+
+	if (dbus_message_is_method_call(msg, FAKE_MANAGER, "GetSession") ||
+	    dbus_message_is_method_call(msg, FAKE_MANAGER, "GetSessionByPID")) {
+		dbus_message_append_args(reply, DBUS_TYPE_OBJECT_PATH, &path, DBUS_TYPE_INVALID);
+	} else if (dbus_message_is_method_call(msg, FAKE_MANAGER, "Inhibit")) {
+		if (!fake_inhibit(f, msg, reply)) {
+			dbus_message_unref(reply);
+			reply = dbus_message_new_error(msg, DBUS_ERROR_FAILED, "check");
+		}
+	} else if (dbus_message_has_member(msg, "SetIdleHint")) {
+		if (!dbus_message_has_path(msg, FAKE_SESSION))
+			fake_fail(f, "SetIdleHint not on the resolved session");
+		else if (dbus_message_get_args(msg, NULL, DBUS_TYPE_BOOLEAN, &b, DBUS_TYPE_INVALID))
+			f->idle_hint = b;
+
+		if (strlen(dbus_message_get_sender(msg)) < sizeof(f->peer))
+			strcpy(f->peer, dbus_message_get_sender(msg));
+	}
+
+	if (reply) {
+		dbus_connection_send(conn, reply, NULL);
+		dbus_message_unref(reply);
+	}
+
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static bool
+fake_inhibitor_closed(const Fake *f)
+{
+	struct pollfd p = { f->inhibitor, POLLIN, 0 };
+
+	return f->inhibitor >= 0 && poll(&p, 1, 0) > 0 && (p.revents & POLLHUP);
+}
+
+static void
+fake_step(Fake *f)
+{
+	if (fake_inhibitor_closed(f)) {
+		close(f->inhibitor);
+		f->inhibitor = -1;
+
+		if (f->phase != FAKE_SLEEPING) {
+			fake_fail(f, "inhibitor closed outside PrepareForSleep");
+			return;
+		}
+
+		f->phase = FAKE_RESUMED;
+		fake_send(f, f->conn, fake_prepare_for_sleep(false), NULL);
+		return;
+	}
+
+	switch (f->phase) {
+	case FAKE_IDLE:
+		if (f->idle_hint && f->inhibitor >= 0) {
+			f->phase = FAKE_SLEEPING;
+			fake_send(f, f->conn, fake_prepare_for_sleep(true), NULL);
+		}
+		break;
+	case FAKE_RESUMED:
+		if (!f->idle_hint && f->inhibitor >= 0 && f->inhibits == 2) {
+			f->phase = FAKE_LOCKED;
+			fake_send(f, f->conn, fake_session_signal("Lock"), NULL);
+		}
+		break;
+	case FAKE_LOCKED:
+		if (f->idle_hint) {
+			f->phase = FAKE_FORGED;
+			fake_forge(f);
+		}
+		break;
+	case FAKE_FORGED:
+		if (!f->idle_hint) {
+			f->phase = FAKE_DONE;
+			fake_send(f, f->conn, fake_session_signal("Unlock"), NULL);
+		}
+		break;
+	}
+}
+
+static int
+fake_run(int ready)
+{
+	static const char *phases[] = { "idle", "sleeping", "resumed", "locked", "forged", "done" };
+	Fake f = { .inhibitor = -1 };
+	DBusError err;
+	unsigned long long end;
+
+	dbus_error_init(&err);
+	if (!(f.conn = dbus_bus_get_private(DBUS_BUS_SYSTEM, &err)) ||
+	    dbus_bus_request_name(f.conn, FAKE_NAME, DBUS_NAME_FLAG_DO_NOT_QUEUE, &err) !=
+	    DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+		warn("[FAKE] cannot own %s: %s", FAKE_NAME,
+		     dbus_error_is_set(&err) ? err.message : "name taken");
+		return 1;
+	}
+
+	if (!(f.forger = dbus_bus_get_private(DBUS_BUS_SYSTEM, &err))) {
+		warn("[FAKE] cannot connect the forger: %s", err.message);
+		return 1;
+	}
+
+	dbus_connection_add_filter(f.conn, fake_filter, &f, NULL);
+
+	/* Name owned, the daemon side may start */
+	if (write(ready, "1", 1) != 1)
+		return 1;
+	close(ready);
+
+	end = monotonic_ms() + CHECK_WAIT_MS;
+	while (!f.failed && f.phase != FAKE_DONE && monotonic_ms() < end &&
+	       dbus_connection_read_write_dispatch(f.conn, 10))
+		fake_step(&f);
+
+	if (!f.failed && f.phase != FAKE_DONE)
+		fake_fail(&f, "timed out");
+
+	if (f.failed)
+		warn("[FAKE] stopped while %s", phases[f.phase]);
+
+	dbus_connection_close(f.forger);
+	dbus_connection_unref(f.forger);
+	dbus_connection_close(f.conn);
+	dbus_connection_unref(f.conn);
+	return f.failed;
+}
+
+/* ------------------------------ daemon side ------------------------------ */
+
+/* One main loop turn for the logind sources, see poll_wait() */
+static unsigned int
+turn(Logind *l)
+{
+	struct pollfd pfds[MAX_POLLFDS];
+	const struct pollfd *src;
+	size_t n;
+	int ret;
+
+	n = logind_pollfds(l, &src);
+	if (n > MAX_POLLFDS)
+		n = MAX_POLLFDS;
+	memcpy(pfds, src, n * sizeof(*pfds));
+
+	ret = poll(pfds, n, 10);
+	(void)logind_dispatch(l, pfds, ret > 0 ? n : 0);
+
+	return logind_events(l);
+}
+
+/*
+ * Turn the loop until ev shows up, or until the fake exits if ev is 0.
+ * Any other event fails the check.
+ */
+static bool
+wait_event(Logind *l, pid_t fake, unsigned int ev, int *status)
+{
+	unsigned long long end = monotonic_ms() + CHECK_WAIT_MS;
+	unsigned int got;
+
+	while (monotonic_ms() < end) {
+		if ((got = turn(l)) & ~ev) {
+			warn("[CHECK] unexpected events 0x%x", got & ~ev);
+			return false;
+		}
+
+		if (got & ev)
+			return true;
+
+		if (waitpid(fake, status, WNOHANG) == fake)
+			return ev == 0;
+	}
+
+	return false;
+}
+
+int
+main(int argc, char *argv[])
+{
+	Logind *l;
+	pid_t fake;
+	int ready[2], status = 1;
+	bool ok = false;
+	bool v = argc > 1 && streq(argv[1], "-v");
+	char c;
+
+	if (pipe(ready) < 0)
+		die("[CHECK] pipe failed:");
+
+	if ((fake = fork()) < 0)
+		die("[CHECK] fork failed:");
+
+	if (fake == 0) {
+		close(ready[0]);
+		_exit(fake_run(ready[1]));
+	}
+
+	close(ready[1]);
+	if (read(ready[0], &c, 1) != 1)
+		die("[CHECK] stand-in logind did not start");
+	close(ready[0]);
+
+	if (!(l = logind_init(v, false))) {
+		kill(fake, SIGTERM);
+		die("[CHECK] logind_init failed");
+	}
+
+	logind_set_idle(l, true);
+
+	if (!wait_event(l, fake, LOGIND_EV_SLEEP, &status)) {
+		warn("[CHECK] no PrepareForSleep(true)");
+		goto out;
+	}
+	logind_sleep_release(l);
+
+	if (!wait_event(l, fake, LOGIND_EV_RESUME, &status)) {
+		warn("[CHECK] no PrepareForSleep(false)");
+		goto out;
+	}
+	logind_sleep_acquire(l);
+	logind_set_idle(l, false);
+
+	if (!wait_event(l, fake, LOGIND_EV_LOCK, &status)) {
+		warn("[CHECK] no Session.Lock");
+		goto out;
+	}
+	logind_set_idle(l, true);
+
+	/* Only the real Lock may come through, the forged signals before it not */
+	if (!wait_event(l, fake, LOGIND_EV_LOCK, &status)) {
+		warn("[CHECK] forged signals accepted or no second Session.Lock");
+		goto out;
+	}
+	logind_set_idle(l, false);
+
+	if (!wait_event(l, fake, LOGIND_EV_UNLOCK, &status)) {
+		warn("[CHECK] no Session.Unlock");
+		goto out;
+	}
+
+	if (!(ok = wait_event(l, fake, 0, &status)))
+		warn("[CHECK] stand-in logind did not finish");
+
+out:
+	logind_cleanup(l);
+	if (waitpid(fake, &status, WNOHANG) == 0) {
+		kill(fake, SIGTERM);
+		waitpid(fake, &status, 0);
+	}
+
+	if (!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		printf("logind: FAIL\n");
+		return 1;
+	}
+
+	printf("logind: ok\n");
+	return 0;
+}
@@ -0,0 +1,104 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Table check for pattern.c: each spec is compiled on its own and
+ * matched against a name. Covers the exact, prefix and fnmatch() paths,
+ * comma lists and the org.mpris.MediaPlayer2. prefix being stripped on
+ * both sides. Any mismatch makes the exit status 1.
+ */
+
+#include <stdio.h>
+
+#include "../pattern.h"
+#include "../utils.h"
+
+#define BUS "org.mpris.MediaPlayer2."
+
+static const struct {
+	const char *spec;
+	const char *name;
+	bool match;
+} cases[] = {
+	/* exact */
+	{ "spotify",             "spotify",                   true  },
+	{ "spotify",             BUS "spotify",               true  },
+	{ "spotify",             "spotifyd",                  false },
+	{ "spotify",             "spot",                      false },
+	{ "spotify",             "",                          false },
+	{ BUS "spotify",         "spotify",                   true  },
+	{ BUS "spotify",         BUS "spotify",               true  },
+	{ "Spotify",             "spotify",                   false },
+
+	/* prefix */
+	{ "firefox*",            "firefox",                   true  },
+	{ "firefox*",            "firefox.instance_1_42",     true  },
+	{ "firefox*",            BUS "firefox.instance_1_42", true  },
+	{ "firefox*",            "fire",                      false },
+	{ "firefox*",            "librewolf",                 false },
+	{ BUS "chromium*",       BUS "chromium.instance7",    true  },
+	{ "*",                   "anything",                  true  },
+	{ "*",                   "",                          true  },
+
+	/* glob */
+	{ "*mpv*",               "io.mpv",                    true  },
+	{ "*mpv*",               BUS "mpv",                   true  },
+	{ "*mpv*",               "vlc",                       false },
+	{ "vlc?",                "vlc2",                      true  },
+	{ "vlc?",                "vlc",                       false },
+	{ "[mk]pv",              "kpv",                       true  },
+	{ "[mk]pv",              "npv",                       false },
+	{ "chrom*.instance*",    "chromium.instance12",       true  },
+	{ "chrom*.instance*",    "chromium",                  false },
+	{ "fire\\*",             "fire*",                     true  },
+	{ "fire\\*",             "firefox",                   false },
+
+	/* lists, every entry stripped on its own */
+	{ "vlc,mpv",             "mpv",                       true  },
+	{ "vlc,mpv",             "vlc",                       true  },
+	{ "vlc,mpv",             "vlcmpv",                    false },
+	{ BUS "vlc," BUS "mpv",  "mpv",                       true  },
+	{ "vlc,firefox*",        BUS "firefox.instance3",     true  },
+	{ "vlc,*mpv",            "io.mpv",                    true  },
+
+	/* only a leading prefix is stripped */
+	{ "mpv",                 "x." BUS "mpv",              false },
+	{ "MediaPlayer2.mpv",    BUS "mpv",                   false },
+};
+
+static const char *bad[] = { "", ",", "vlc,", ",vlc", "vlc,,mpv", BUS, "vlc," BUS };
+
+int
+main(void)
+{
+	PatternList l;
+	bool failed = false;
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		l = (PatternList){ 0 };
+
+		if (patterns_add(&l, cases[i].spec) < 0) {
+			warn("[CHECK] \"%s\" rejected", cases[i].spec);
+			failed = true;
+		} else if (patterns_match(&l, cases[i].name) != cases[i].match) {
+			warn("[CHECK] \"%s\" vs \"%s\": expected %s", cases[i].spec, cases[i].name,
+			     cases[i].match ? "a match" : "no match");
+			failed = true;
+		}
+
+		patterns_free(&l);
+	}
+
+	for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		l = (PatternList){ 0 };
+
+		if (patterns_add(&l, bad[i]) == 0) {
+			warn("[CHECK] \"%s\" accepted", bad[i]);
+			failed = true;
+		}
+
+		patterns_free(&l);
+	}
+
+	printf("pattern: %s\n", failed ? "FAIL" : "ok");
+	return failed;
+}
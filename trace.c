@@ -0,0 +1,70 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "utils.h"
+
+#define TRACE_LINE_MAX 256
+
+static TraceRecord g_ring[TRACE_RECORDS];
+static size_t g_next;    /* slot written next */
+static size_t g_count;   /* valid records, up to TRACE_RECORDS */
+
+/* One write() per line, so lines from a dying process stay whole. */
+static int
+put_line(int fd, const char *line, int len)
+{
+	if (len <= 0)
+		return 0;
+	if (len >= TRACE_LINE_MAX)
+		len = TRACE_LINE_MAX - 1;
+
+	return write(fd, line, (size_t)len) < 0 ? -1 : 0;
+}
+
+void
+trace_record(const TraceRecord *r)
+{
+	g_ring[g_next] = *r;
+	g_next = (g_next + 1) % TRACE_RECORDS;
+	if (g_count < TRACE_RECORDS)
+		g_count++;
+}
+
+void
+trace_dump(int fd, size_t n)
+{
+	unsigned long long now_ms = monotonic_ms();
+	char line[TRACE_LINE_MAX];
+	int len;
+
+	if (n > g_count)
+		n = g_count;
+
+	len = snprintf(line, sizeof(line), "xcoffeebreak: [TRACE] last %zu of %zu iterations\n",
+	               n, g_count);
+	if (put_line(fd, line, len) < 0)
+		return;
+
+	for (size_t i = (g_next + TRACE_RECORDS - n) % TRACE_RECORDS; n; n--, i = (i + 1) % TRACE_RECORDS) {
+		const TraceRecord *r = &g_ring[i];
+
+		len = snprintf(line, sizeof(line),
+		               "xcoffeebreak: [TRACE] t=%llu age_ms=%llu raw=%lu eff=%lu playing=%u "
+		               "inhibit=0x%x state=%s->%s x_us=%u bus_us=%u\n",
+		               r->t_ms, now_ms > r->t_ms ? now_ms - r->t_ms : 0,
+		               r->raw_idle_ms, r->eff_idle_ms, r->playing, r->inhibit,
+		               state_name((State)r->current), state_name((State)r->decided),
+		               r->x_us, r->bus_us);
+		if (put_line(fd, line, len) < 0)
+			return;
+	}
+}
+
+void
+trace_dump_on_die(void)
+{
+	trace_dump(STDERR_FILENO, TRACE_DIE_RECORDS);
+}
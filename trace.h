@@ -0,0 +1,38 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef XCOFFEEBREAK_TRACE_H
+#define XCOFFEEBREAK_TRACE_H
+
+#include <stddef.h>
+
+#include "state.h"
+
+#define TRACE_RECORDS     256  /* ring size, ~4 min at the default poll_ms */
+#define TRACE_DIE_RECORDS 32   /* dumped by die() */
+
+/* One main loop iteration */
+typedef struct {
+	unsigned long long t_ms;     /* monotonic_ms() at the end of the iteration */
+	unsigned long raw_idle_ms;   /* from the X server */
+	unsigned long eff_idle_ms;   /* raw minus baseline */
+	unsigned int  playing;       /* MPRIS players reporting Playing */
+	unsigned int  inhibit;       /* INHIBIT_* mask fed to the update */
+	unsigned char current;       /* State before the update */
+	unsigned char decided;       /* State returned by the update */
+	unsigned int  x_us;          /* X idle query */
+	unsigned int  bus_us;        /* fd dispatch after poll() woke up */
+} TraceRecord;
+
+/*
+ * Append a record, overwriting the oldest. A copy into a static ring:
+ * no allocation and no I/O, fine to call every iteration.
+ */
+void trace_record(const TraceRecord *r);
+
+/* Write the last n records (at most TRACE_RECORDS), oldest first, to fd. */
+void trace_dump(int fd, size_t n);
+
+/* trace_dump(STDERR_FILENO, TRACE_DIE_RECORDS), for die_hook(). */
+void trace_dump_on_die(void);
+
+#endif /* XCOFFEEBREAK_TRACE_H */
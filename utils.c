@@ -6,68 +6,71 @@
 #include <stdlib.h>
 #include <time.h>
 
+#include "log.h"
 #include "utils.h"
 
+static void (*g_die_hook)(void);
+
 void
 die(const char *fmt, ...)
 {
+	void (*hook)(void) = g_die_hook;
 	va_list ap;
 	int saved_errno = errno;
 
-	fputs("xcoffeebreak: [FATAL] ", stderr);
-
 	va_start(ap, fmt);
-	vfprintf(stderr, fmt, ap);
+	log_vwrite(LOG_FATAL, NULL, saved_errno, fmt, ap);
 	va_end(ap);
 
-	if (fmt[0] && fmt[strlen(fmt) - 1] == ':')
-		fprintf(stderr, " %s", strerror(saved_errno));
-	fputc('\n', stderr);
-
+	/* Cleared first: a hook that dies itself must not loop */
+	if (hook) {
+		g_die_hook = NULL;
+		hook();
+	}
 
 	exit(1);
 }
 
+void
+set_die_hook(void (*hook)(void))
+{
+	g_die_hook = hook;
+}
+
 void
 warn(const char *fmt, ...)
 {
 	va_list ap;
 	int saved_errno = errno;
 
-	fputs("xcoffeebreak: [WARN] ", stderr);
-
 	va_start(ap, fmt);
-	vfprintf(stderr, fmt, ap);
+	log_vwrite(LOG_WARN, NULL, saved_errno, fmt, ap);
 	va_end(ap);
-
-	if (fmt[0] && fmt[strlen(fmt) - 1] == ':')
-		fprintf(stderr, " %s", strerror(saved_errno));
-	fputc('\n', stderr);
 }
 
 void
 verbose(const bool v, const char *fmt, ...)
 {
-	struct tm tm;
 	va_list ap;
-	time_t now;
 
 	if (!v)
 		return;
 
-	now = time(NULL);
-	if (now == (time_t)-1 || !localtime_r(&now, &tm))
-		die("failed to populate struct tm:");
-
-	fprintf(stderr, "xcoffeebreak: [VERBOSE] [%04d-%02d-%02d %02d:%02d:%02d] ",
-	        tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
-	        tm.tm_hour, tm.tm_min, tm.tm_sec);
-
 	va_start(ap, fmt);
-	vfprintf(stderr, fmt, ap);
+	log_vwrite(LOG_VERBOSE, NULL, -1, fmt, ap);
 	va_end(ap);
+}
+
+unsigned long long
+monotonic_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
 
-	fputc('\n', stderr);
+	return (unsigned long long)ts.tv_sec * 1000ULL +
+	       (unsigned long long)ts.tv_nsec / 1000000ULL;
 }
 
 void *
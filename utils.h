@@ -14,6 +14,12 @@
  */
 void die(const char *fmt, ...);
 
+/*
+ * Run hook from die(), after the message and before exiting (once;
+ * NULL removes it). For last-gasp diagnostics.
+ */
+void set_die_hook(void (*hook)(void));
+
 /*
  * Prints formated message to stderr and returns.
  * If last char is ':', prints strerror with set errno.
@@ -26,6 +32,9 @@ void warn(const char *fmt, ...);
  */
 void verbose(const bool v, const char *fmt, ...);
 
+/* CLOCK_MONOTONIC in ms, 0 on failure. */
+unsigned long long monotonic_ms(void);
+
 /* Calls calloc and exits on failure. */
 void *ecalloc(size_t nmemb, size_t size);
 
@@ -3,12 +3,14 @@
 #include <X11/Xlib.h>
 #include <X11/extensions/scrnsaver.h>
 
+#include "metrics.h"
 #include "utils.h"
 #include "x.h"
 
 struct X11 {
 	Display *dpy;
 	XScreenSaverInfo *info;
+	Window locker;           /* full-screen override-redirect candidate */
 };
 
 X11 *
@@ -47,11 +49,66 @@ x11_cleanup(X11 *x)
 unsigned long
 x11_idle_ms(X11 *x)
 {
+	unsigned long long t0;
+
 	if (!x || !x->dpy || !x->info)
 		die("[X11] Connection lost");
 
+	/* A full round trip to the server, every iteration */
+	t0 = metrics_now_us();
 	if (!XScreenSaverQueryInfo(x->dpy, DefaultRootWindow(x->dpy), x->info))
 		die("[X11] XScreenSaverQueryInfo failed");
+	metrics_observe(MET_X11_IDLE, metrics_now_us() - t0);
 
 	return x->info->idle;
 }
+
+void
+x11_locker_watch(X11 *x, bool on)
+{
+	if (!x || !x->dpy)
+		die("[X11] Connection lost");
+
+	x->locker = None;
+	XSelectInput(x->dpy, DefaultRootWindow(x->dpy), on ? SubstructureNotifyMask : NoEventMask);
+
+	/* In effect before the locker starts; leftover events dropped when done */
+	XSync(x->dpy, on ? False : True);
+}
+
+bool
+x11_locker_mapped(X11 *x)
+{
+	XEvent ev;
+	int w, h;
+
+	if (!x || !x->dpy)
+		die("[X11] Connection lost");
+
+	w = DisplayWidth(x->dpy, DefaultScreen(x->dpy));
+	h = DisplayHeight(x->dpy, DefaultScreen(x->dpy));
+
+	/* Only what is already queued, no round trip */
+	while (XPending(x->dpy)) {
+		XNextEvent(x->dpy, &ev);
+
+		switch (ev.type) {
+		case CreateNotify:
+			if (ev.xcreatewindow.override_redirect &&
+			    ev.xcreatewindow.width >= w && ev.xcreatewindow.height >= h)
+				x->locker = ev.xcreatewindow.window;
+			break;
+		case ConfigureNotify:
+			if (ev.xconfigure.override_redirect &&
+			    ev.xconfigure.width >= w && ev.xconfigure.height >= h)
+				x->locker = ev.xconfigure.window;
+			break;
+		case MapNotify:
+			if (x->locker != None && ev.xmap.window == x->locker)
+				return true;
+			break;
+		}
+	}
+
+	return false;
+}
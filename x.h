@@ -3,6 +3,8 @@
 #ifndef XCOFFEEBREAK_X_H
 #define XCOFFEEBREAK_X_H
 
+#include <stdbool.h>
+
 typedef struct X11 X11;
 
 /*
@@ -23,4 +25,20 @@ void x11_cleanup(X11 *x);
  */
 unsigned long x11_idle_ms(X11 *x);
 
+/*
+ * Start (on) or stop watching the root window for a screen locker: a
+ * full-screen override-redirect window, as slock, i3lock and
+ * xsecurelock map. Nothing is grabbed, the locker's own grab is left
+ * alone. Start before spawning the locker.
+ */
+void x11_locker_watch(X11 *x, bool on);
+
+/*
+ * Checks the events queued since x11_locker_watch(x, true) without
+ * blocking.
+ *
+ * Returns true once the locker window is mapped.
+ */
+bool x11_locker_mapped(X11 *x);
+
 #endif /* XCOFFEEBREAK_X_H */
@@ -7,46 +7,89 @@
  * To understand everything, start reading main().
  */
 
+#include <errno.h>
+#include <poll.h>
 #include <signal.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "alloc.h"
 #include "args.h"
+#include "asound.h"
+#include "camera.h"
+#include "ctl.h"
+#include "log.h"
+#include "logind.h"
+#include "metrics.h"
 #include "mpris.h"
 #include "state.h"
+#include "trace.h"
 #include "utils.h"
 #include "x.h"
 
+#define MAX_POLLFDS 16  /* fds polled by the main loop, all sources */
+
+/* Before sleep: how long to wait for the locker to map its window */
+#define LOCKER_WAIT_MS 2000
+#define LOCKER_POLL_MS 50
+
 static volatile sig_atomic_t g_running = 1;
+static volatile sig_atomic_t g_dump_metrics = 0;
+static volatile sig_atomic_t g_dump_trace = 0;
 
 /* Forward declarations */
-static void cleanup(Options *opt, X11 *x, Mpris *m);
-static void init(Options *opt, X11 **x, StateManager *sm, Mpris **m);
+static void cleanup(Options *opt, X11 *x, Mpris *m, Logind *l, Asound *a, Camera *c, Ctl *ctl);
+static void init(Options *opt, X11 **x, StateManager *sm, Mpris **m, Logind **l, Asound **a, Camera **c,
+                 Ctl **ctl);
 static void signals_init(void);
-static void poll_wait(Mpris **m, unsigned int timeout_ms);
+static size_t pollfds_add(struct pollfd *pfds, size_t n, const struct pollfd *src, size_t nsrc);
+static unsigned int poll_wait(Mpris *m, Logind *l, Camera *c, Ctl *ctl, unsigned int timeout_ms);
+static void publish_state(const Options *opt, Mpris *m, Logind *l, Ctl *ctl, const StateManager *sm);
+static void wait_for_locker(X11 *x);
+static bool handle_logind(Options *opt, X11 *x, StateManager *sm, Logind *l);
+static void handle_dumps(void);
 static void sighandler(int sig);
+static void sigusrhandler(int sig);
 
 void
-cleanup(Options *opt, X11 *x, Mpris *m)
+cleanup(Options *opt, X11 *x, Mpris *m, Logind *l, Asound *a, Camera *c, Ctl *ctl)
 {
-	args_free(opt);
+	metrics_cleanup();
+	ctl_cleanup(ctl);
+	camera_cleanup(c);
+	asound_cleanup(a);
+	logind_cleanup(l);
 	mpris_cleanup(m);
 	x11_cleanup(x);
+	args_free(opt);
+	log_close();
 }
 
 void
-init(Options *opt, X11 **x, StateManager *sm, Mpris **m)
+init(Options *opt, X11 **x, StateManager *sm, Mpris **m, Logind **l, Asound **a, Camera **c,
+     Ctl **ctl)
 {
 	signals_init();
+	set_die_hook(trace_dump_on_die);
+	if (opt->journal)
+		(void)log_journal_open(opt->verbose);  /* stays on stderr otherwise */
+	metrics_init(opt->verbose);
 	*x = x11_init();
-	*m = mpris_init(opt->verbose);
-	state_manager_init(sm, x11_idle_ms(*x));
+	state_manager_init(sm, x11_idle_ms(*x));  /* idle counts from here on */
+	*m = mpris_init(opt);
+	*l = logind_init(opt->verbose, opt->dry_run);
+	*a = NULL;
+	if (opt->audio_inhibit || opt->capture_inhibit)
+		*a = asound_init(ASOUND_ROOT, opt->capture_inhibit, opt->verbose);
+	*c = opt->camera_inhibit ? camera_init(CAMERA_DIR, opt->verbose) : NULL;
+	*ctl = ctl_init(opt->verbose);
 }
 
 void
 signals_init(void)
 {
 	struct sigaction sa = {0};
+	struct sigaction sausr = {0};
 	struct sigaction sachld = {0};
 
 	/* Setup signal handlers FIRST, before any fork() calls */
@@ -54,30 +97,168 @@ signals_init(void)
 	sigaction(SIGINT,  &sa, NULL);
 	sigaction(SIGTERM, &sa, NULL);
 
+	/* Metrics and trace dumps; interrupt poll() so they are served right away */
+	sausr.sa_handler = sigusrhandler;
+	sigaction(SIGUSR1, &sausr, NULL);
+	sigaction(SIGUSR2, &sausr, NULL);
+
 	/* Avoid zombie children from non-blocking fork/exec */
 	sachld.sa_handler = SIG_IGN;
 	sachld.sa_flags = SA_NOCLDWAIT;
 	sigaction(SIGCHLD, &sachld, NULL);
 }
 
+size_t
+pollfds_add(struct pollfd *pfds, size_t n, const struct pollfd *src, size_t nsrc)
+{
+	if (nsrc > MAX_POLLFDS - n)
+		nsrc = MAX_POLLFDS - n;
+
+	for (size_t i = 0; i < nsrc; i++) {
+		pfds[n + i] = src[i];
+		pfds[n + i].revents = 0;
+	}
+
+	return nsrc;
+}
+
+unsigned int
+poll_wait(Mpris *m, Logind *l, Camera *c, Ctl *ctl, unsigned int timeout_ms)
+{
+	struct pollfd pfds[MAX_POLLFDS];
+	unsigned long long now_ms, deadline_ms, busy_us = 0;
+
+	now_ms = monotonic_ms();
+	deadline_ms = now_ms + timeout_ms;
+
+	/*
+	 * One poll() over the session and system bus, the camera inotify fd
+	 * and the control socket. Returns on activity or after timeout_ms;
+	 * bus timers wake it in between without ending the wait, so the X
+	 * server is still queried once per interval.
+	 * Returns the time spent dispatching (not sleeping), in us.
+	 */
+	for (;;) {
+		const struct pollfd *src;
+		struct pollfd cam = { camera_fd(c), POLLIN, 0 };
+		size_t nm, nl, nc, nk;
+		unsigned long long t0;
+		unsigned int wait;
+		int ready, tmo;
+
+		nm = mpris_pollfds(m, &src);
+		nm = pollfds_add(pfds, 0, src, nm);
+		nl = logind_pollfds(l, &src);
+		nl = pollfds_add(pfds, nm, src, nl);
+		nc = cam.fd >= 0 ? pollfds_add(pfds, nm + nl, &cam, 1) : 0;
+		nk = ctl_pollfds(ctl, &src);
+		nk = pollfds_add(pfds, nm + nl + nc, src, nk);
+
+		wait = deadline_ms > now_ms ? (unsigned int)(deadline_ms - now_ms) : 0;
+		if ((tmo = mpris_timeout_ms(m)) >= 0 && (unsigned int)tmo < wait)
+			wait = (unsigned int)tmo;
+		if ((tmo = logind_timeout_ms(l)) >= 0 && (unsigned int)tmo < wait)
+			wait = (unsigned int)tmo;
+
+		ready = poll(pfds, (nfds_t)(nm + nl + nc + nk), (int)wait);
+		if (ready < 0) {
+			if (errno != EINTR)
+				warn("poll:");
+			return (unsigned int)busy_us;
+		}
+
+		t0 = metrics_now_us();
+		(void)mpris_dispatch(m, pfds, ready ? nm : 0);
+
+		(void)logind_dispatch(l, pfds + nm, ready ? nl : 0);
+
+		if (nc && pfds[nm + nl].revents)
+			camera_dispatch(c);
+
+		ctl_dispatch(ctl, pfds + nm + nl + nc, ready ? nk : 0);
+		busy_us += metrics_now_us() - t0;
+
+		now_ms = monotonic_ms();
+		if (ready > 0 || !now_ms || now_ms >= deadline_ms)
+			return (unsigned int)busy_us;
+	}
+}
+
 void
-poll_wait(Mpris **m, unsigned int timeout_ms)
+publish_state(const Options *opt, Mpris *m, Logind *l, Ctl *ctl, const StateManager *sm)
 {
-	if (m && *m) {
-		if (mpris_poll(*m, timeout_ms) < 0) {
-			warn("[MPRIS] Lost DBus connection, running without inhibit");
-			mpris_cleanup(*m);
-			*m = NULL;
+	/* All of these only talk to their peers when the value actually changes */
+	mpris_publish_state(m, sm->current >= ST_LOCKED, sm->last_raw_idle_ms);
+	logind_set_idle(l, sm->current != ST_ACTIVE);
+	ctl_publish(ctl, sm, opt);
+}
+
+void
+wait_for_locker(X11 *x)
+{
+	struct timespec ts = { 0, LOCKER_POLL_MS * 1000000L };
+
+	for (unsigned int waited = 0; waited < LOCKER_WAIT_MS; waited += LOCKER_POLL_MS) {
+		if (x11_locker_mapped(x))
 			return;
-		}
+		nanosleep(&ts, NULL);
+	}
+
+	warn("[STATE] locker did not map a window within %d ms", LOCKER_WAIT_MS);
+}
+
+bool
+handle_logind(Options *opt, X11 *x, StateManager *sm, Logind *l)
+{
+	unsigned int ev = logind_events(l);
+
+	if (ev & LOGIND_EV_SLEEP) {
+		/* Lock first, only then let logind suspend */
+		x11_locker_watch(x, true);
+		if (state_manager_lock(sm, opt, "prepare for sleep") &&
+		    !opt->dry_run && opt->lock_cmd && *opt->lock_cmd)
+			wait_for_locker(x);
+		x11_locker_watch(x, false);
+		logind_sleep_release(l);
+	}
+
+	/* Remote lock: same path as the idle lock, deduped on state and locker */
+	if (ev & LOGIND_EV_LOCK)
+		(void)state_manager_lock(sm, opt, "logind Lock");
+
+	if (ev & LOGIND_EV_UNLOCK)
+		state_manager_unlock(sm, x11_idle_ms(x), opt->verbose);
+
+	if (ev & LOGIND_EV_RESUME) {
+		logind_sleep_acquire(l);
+		state_manager_handle_resume(sm, x11_idle_ms(x), opt->verbose);
+	}
+
+	return ev != 0;
+}
+
+void
+handle_dumps(void)
+{
+	static unsigned long long next_write_ms;
+	unsigned long long now_ms = monotonic_ms();
+
+	metrics_add(MET_LOOP_ITERATIONS, 1);
+
+	if (g_dump_trace) {
+		g_dump_trace = 0;
+		trace_dump(STDERR_FILENO, TRACE_RECORDS);
+	}
+
+	if (g_dump_metrics) {
+		g_dump_metrics = 0;
+		metrics_dump(STDERR_FILENO);
+	} else if (now_ms < next_write_ms) {
 		return;
 	}
 
-	struct timespec ts = {
-		.tv_sec = timeout_ms / 1000,
-		.tv_nsec = (timeout_ms % 1000) * 1000000L
-	};
-	nanosleep(&ts, NULL);
+	next_write_ms = now_ms + METRICS_WRITE_S * 1000ULL;
+	metrics_write();
 }
 
 void
@@ -87,39 +268,106 @@ sighandler(int sig)
 	g_running = 0;
 }
 
+void
+sigusrhandler(int sig)
+{
+	if (sig == SIGUSR1)
+		g_dump_metrics = 1;
+	else
+		g_dump_trace = 1;
+}
+
 int
 main(int argc, char *argv[])
 {
 	Options opt;
 	StateManager sm;
 	Mpris *m = NULL;
+	Logind *l = NULL;
+	Asound *a = NULL;
+	Camera *c = NULL;
+	Ctl *ctl = NULL;
 	X11 *x = NULL;
+	unsigned long long start_ms = monotonic_ms();
+	bool sampled = false;
 
 	if (args_set(&opt, argc, argv))
 		return 1;
 
-	init(&opt, &x, &sm, &m);
+	/* --ctl: talk to the running daemon and exit */
+	if (opt.ctl) {
+		int ret = ctl_client(opt.ctl);
+		args_free(&opt);
+		return ret;
+	}
+
+	init(&opt, &x, &sm, &m, &l, &a, &c, &ctl);
 
 	while (g_running) {
+		TraceRecord tr = {0};
+		unsigned long long t0;
 		State st;
 
-		poll_wait(&m, opt.poll_ms);
+		/* No wait before the first sample; bus setup replies merge in as they come */
+		tr.bus_us = poll_wait(m, l, c, ctl, sampled ? opt.poll_ms : 0);
+		handle_dumps();
+
+		/* Sleep/resume announced by logind, then the clock jump fallback */
+		if (handle_logind(&opt, x, &sm, l)) {
+			publish_state(&opt, m, l, ctl, &sm);
+			continue;
+		}
 
-		/* Check for suspend/resume */
 		if (state_manager_check_suspend(&sm)) {
 			state_manager_handle_resume(&sm, x11_idle_ms(x), opt.verbose);
+			publish_state(&opt, m, l, ctl, &sm);
 			continue;
 		}
 
-		st = state_manager_update(&sm, &opt, x11_idle_ms(x), mpris_is_playing(m));
+		if (ctl_events(ctl) & CTL_EV_LOCK)
+			(void)state_manager_lock(&sm, &opt, "ctl lock");
+
+		t0 = metrics_now_us();
+		tr.raw_idle_ms = x11_idle_ms(x);
+		tr.x_us = (unsigned int)(metrics_now_us() - t0);
+
+		if (!sampled) {
+			verbose(opt.verbose, "[STATE] first idle sample %llu ms after start",
+			        monotonic_ms() - start_ms);
+			sampled = true;
+			alloc_guard_arm();  /* warmed up, no allocation from here on */
+		}
+
+		tr.inhibit = mpris_inhibit_mask(m) | asound_inhibit_mask(a) |
+		             camera_inhibit_mask(c) | ctl_inhibit_mask(ctl);
+		tr.current = (unsigned char)sm.current;
+
+		st = state_manager_update(&sm, &opt, tr.raw_idle_ms, tr.inhibit);
+
+		tr.eff_idle_ms = state_manager_idle_ms(&sm);
+		tr.playing = mpris_playing_count(m);
+		tr.decided = (unsigned char)st;
+		tr.t_ms = monotonic_ms();
+		trace_record(&tr);
 
 		/* Forward transitions execute commands */
 		if (st > sm.current) {
-			state_transition(&opt, sm.current, st);
+			/* Latency: idle past the threshold plus the time to start commands */
+			unsigned long long late_us = metrics_now_us();
+			unsigned long idle_ms = state_manager_idle_ms(&sm);
+			unsigned long thr_ms = state_threshold_ms(&opt, st);
+			unsigned long over_ms = idle_ms > thr_ms ? idle_ms - thr_ms : 0;
+
+			state_transition(&opt, sm.current, st, idle_ms);
 			sm.current = st;
+
+			late_us = metrics_now_us() - late_us + over_ms * 1000ULL;
+			metrics_observe(MET_TRANSITION, late_us);
 		}
+
+		publish_state(&opt, m, l, ctl, &sm);
 	}
 
-	cleanup(&opt, x, m);
+	cleanup(&opt, x, m, l, a, c, ctl);
 	return 0;
 }